@@ -0,0 +1,235 @@
+#include "allocator.h"
+
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+
+namespace {
+
+// Size classes are powers of two from 16 bytes to 64 KiB
+const int kMinClassShift = 4;
+const int kMaxClassShift = 16;
+const int kClassCount = kMaxClassShift - kMinClassShift + 1;
+
+// Blocks kept per size class in each thread cache and in the shared pool.
+// Anything beyond that is returned to the system.
+const int kThreadCacheBlocks = 32;
+const int kPoolBlocks = 1024;
+
+// Buffers at least this large are mapped with huge pages when enabled
+const size_t kHugePageSize = 2 * 1024 * 1024;
+
+struct FreeBlock {
+  FreeBlock* next;
+};
+
+struct FreeList {
+  FreeBlock* head = nullptr;
+  int count = 0;
+
+  void Push(void* data) {
+    FreeBlock* block = static_cast<FreeBlock*>(data);
+    block->next = head;
+    head = block;
+    count++;
+  }
+
+  void* Pop() {
+    FreeBlock* block = head;
+    if (block != nullptr) {
+      head = block->next;
+      count--;
+    }
+    return block;
+  }
+};
+
+struct SharedPool {
+  std::mutex mutex;
+  FreeList lists[kClassCount];
+};
+
+SharedPool& Pool() {
+  // Intentionally leaked so it outlives the thread caches of exiting threads
+  static SharedPool* pool = new SharedPool();
+  return *pool;
+}
+
+struct ThreadCache {
+  FreeList lists[kClassCount];
+
+  ~ThreadCache() {
+    SharedPool& pool = Pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    for (int i = 0; i < kClassCount; i++) {
+      while (void* data = lists[i].Pop()) {
+        if (pool.lists[i].count < kPoolBlocks) {
+          pool.lists[i].Push(data);
+        } else {
+          free(data);
+        }
+      }
+    }
+  }
+};
+
+thread_local ThreadCache threadCache;
+
+int SizeClass(size_t length) {
+  if (length > (size_t(1) << kMaxClassShift)) {
+    return -1;
+  }
+
+  int shift = kMinClassShift;
+  while ((size_t(1) << shift) < length) {
+    shift++;
+  }
+  return shift - kMinClassShift;
+}
+
+void* AllocateBlock(int cls) {
+  if (void* data = threadCache.lists[cls].Pop()) {
+    return data;
+  }
+
+  {
+    SharedPool& pool = Pool();
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    if (void* data = pool.lists[cls].Pop()) {
+      return data;
+    }
+  }
+
+  return malloc(size_t(1) << (cls + kMinClassShift));
+}
+
+void ReleaseBlock(void* data, int cls) {
+  FreeList& local = threadCache.lists[cls];
+  if (local.count < kThreadCacheBlocks) {
+    local.Push(data);
+    return;
+  }
+
+  SharedPool& pool = Pool();
+  std::lock_guard<std::mutex> lock(pool.mutex);
+  if (pool.lists[cls].count < kPoolBlocks) {
+    pool.lists[cls].Push(data);
+    return;
+  }
+  free(data);
+}
+
+size_t HugePageLength(size_t length) {
+  return (length + kHugePageSize - 1) & ~(kHugePageSize - 1);
+}
+
+// Maps HugePageLength(length) bytes aligned to kHugePageSize, so the whole
+// region can be backed by huge pages. mmap only aligns to the base page size,
+// so a larger region is mapped and the unaligned ends are unmapped again.
+void* MapHugePages(size_t length) {
+  size_t mapped_length = HugePageLength(length) + kHugePageSize;
+  void* mapped = mmap(nullptr, mapped_length, PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) {
+    return nullptr;
+  }
+
+  uintptr_t start = reinterpret_cast<uintptr_t>(mapped);
+  uintptr_t aligned = (start + kHugePageSize - 1) & ~(kHugePageSize - 1);
+  size_t head = aligned - start;
+  size_t tail = mapped_length - head - HugePageLength(length);
+  if (head > 0) {
+    munmap(mapped, head);
+  }
+  if (tail > 0) {
+    munmap(reinterpret_cast<void*>(aligned + HugePageLength(length)), tail);
+  }
+
+  void* data = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+  madvise(data, HugePageLength(length), MADV_HUGEPAGE);
+#endif
+  return data;
+}
+
+}  // namespace
+
+PooledAllocator::PooledAllocator(size_t limit, bool huge_pages)
+    : limit_(limit),
+      huge_pages_(huge_pages),
+      allocated_(0),
+      peak_(0),
+      failed_(0) {}
+
+bool PooledAllocator::Reserve(size_t length) {
+  size_t current = allocated_.load(std::memory_order_relaxed);
+  size_t next;
+  do {
+    next = current + length;
+    if (limit_ != 0 && next > limit_) {
+      failed_.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+  } while (!allocated_.compare_exchange_weak(current, next,
+                                             std::memory_order_relaxed));
+
+  size_t peak = peak_.load(std::memory_order_relaxed);
+  while (next > peak &&
+         !peak_.compare_exchange_weak(peak, next, std::memory_order_relaxed)) {
+  }
+  return true;
+}
+
+void* PooledAllocator::AllocateUninitialized(size_t length) {
+  if (!Reserve(length)) {
+    return nullptr;
+  }
+
+  void* data = nullptr;
+  int cls = SizeClass(length);
+  if (cls >= 0) {
+    data = AllocateBlock(cls);
+  } else if (huge_pages_ && length >= kHugePageSize) {
+    data = MapHugePages(length);
+  } else {
+    data = malloc(length);
+  }
+
+  if (data == nullptr) {
+    allocated_.fetch_sub(length, std::memory_order_relaxed);
+    failed_.fetch_add(1, std::memory_order_relaxed);
+  }
+  return data;
+}
+
+void* PooledAllocator::Allocate(size_t length) {
+  // Fresh anonymous mappings are already zeroed
+  if (huge_pages_ && SizeClass(length) < 0 && length >= kHugePageSize) {
+    return AllocateUninitialized(length);
+  }
+
+  void* data = AllocateUninitialized(length);
+  if (data != nullptr) {
+    memset(data, 0, length);
+  }
+  return data;
+}
+
+void PooledAllocator::Free(void* data, size_t length) {
+  if (data == nullptr) {
+    return;
+  }
+
+  allocated_.fetch_sub(length, std::memory_order_relaxed);
+
+  int cls = SizeClass(length);
+  if (cls >= 0) {
+    ReleaseBlock(data, cls);
+  } else if (huge_pages_ && length >= kHugePageSize) {
+    munmap(data, HugePageLength(length));
+  } else {
+    free(data);
+  }
+}
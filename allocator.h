@@ -0,0 +1,38 @@
+#ifndef V8ENGINE_ALLOCATOR_H
+#define V8ENGINE_ALLOCATOR_H
+
+#include "v8.h"
+
+#include <atomic>
+#include <cstddef>
+
+// ArrayBuffer allocator with one instance per isolate. Small buffers are
+// served from process-wide size-class free lists fronted by thread-local
+// caches; large buffers go straight to the system, optionally backed by huge
+// pages. Every instance accounts the bytes it hands out and can enforce a
+// limit, in which case V8 throws a RangeError for the failed allocation.
+class PooledAllocator : public v8::ArrayBuffer::Allocator {
+ public:
+  PooledAllocator(size_t limit, bool huge_pages);
+
+  void* Allocate(size_t length) override;
+  void* AllocateUninitialized(size_t length) override;
+  void Free(void* data, size_t length) override;
+
+  size_t allocated() const { return allocated_.load(); }
+  size_t peak() const { return peak_.load(); }
+  size_t failed() const { return failed_.load(); }
+  size_t limit() const { return limit_; }
+
+ private:
+  bool Reserve(size_t length);
+
+  const size_t limit_;  // 0 means unlimited
+  const bool huge_pages_;
+
+  std::atomic<size_t> allocated_;
+  std::atomic<size_t> peak_;
+  std::atomic<size_t> failed_;
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef V8ENGINE_BENCH_CGO_EXPORT_H
+#define V8ENGINE_BENCH_CGO_EXPORT_H
+
+// Stands in for the header cgo generates from the //export functions of the
+// Go package, so v8engine.cc can be linked without Go. The functions are
+// defined by the benchmark harness.
+
+#include <stdint.h>
+
+typedef int64_t GoInt;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ResolveModule_return {
+  char* r0;
+  int r1;
+};
+
+extern struct ResolveModule_return ResolveModule(char* moduleSpecifier,
+                                                 char* referrerSpecifier,
+                                                 GoInt resolverToken);
+extern int WriteHeapSnapshotChunk(char* data, int size, int writerToken);
+extern int WriteTraceChunk(char* data, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
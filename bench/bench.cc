@@ -0,0 +1,309 @@
+// Micro-benchmarks of the C API in v8engine.h, without cgo in the way. Build
+// and run from the repository root:
+//
+//   g++ -O2 -std=c++11 -fno-rtti -I. -Ibench -Ideps/include -o v8bench \
+//       bench/bench.cc v8engine.cc allocator.cc pprof.cc \
+//       -Ldeps/linux-x86_64 -lv8 -pthread -ldl
+//   ./v8bench [name filter]
+//
+// Results are printed in the Go benchmark format, so benchstat can put them
+// next to the numbers of `go test -bench`; the difference is the cgo and
+// engine.go overhead. Calls instrumented in the C layer also report their
+// average lock, compile, execute and marshal time per call.
+
+#include "v8engine.h"
+
+#include "histogram.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "_cgo_export.h"
+
+// Exports of the Go package
+
+extern "C" {
+
+// Every specifier is its own canonical name
+ResolveModule_return ResolveModule(char* moduleSpecifier,
+                                   char* referrerSpecifier,
+                                   GoInt resolverToken) {
+  ResolveModule_return rtn = {strdup(moduleSpecifier), 0};
+  return rtn;
+}
+
+int WriteHeapSnapshotChunk(char* data, int size, int writerToken) {
+  return 0;
+}
+
+int WriteTraceChunk(char* data, int size) {
+  return 0;
+}
+}
+
+// Harness
+
+const uint64_t kBenchmarkNanos = 1000000000;
+
+class B {
+ public:
+  explicit B(int n)
+      : n(n), running_(true), elapsed_(0), start_(MonotonicNanos()) {}
+
+  void StartTimer() {
+    if (!running_) {
+      start_ = MonotonicNanos();
+      running_ = true;
+    }
+  }
+
+  void StopTimer() {
+    if (running_) {
+      elapsed_ += MonotonicNanos() - start_;
+      running_ = false;
+    }
+  }
+
+  // Reports the average duration of each phase of an instrumented call
+  void ReportPhases(ContextPtr ctx, int call) {
+    static const char* names[] = {"lock", "compile", "execute", "marshal"};
+    for (int phase = kPhaseLock; phase < kPhaseTotal; phase++) {
+      HistogramSnapshot snapshot = GetCallStats(ctx, call, phase);
+      if (snapshot.count > 0) {
+        metrics_ += "\t" + std::to_string(snapshot.total / n) + " " +
+                    names[phase] + "-ns/op";
+      }
+    }
+  }
+
+  uint64_t Elapsed() const { return elapsed_; }
+  const std::string& Metrics() const { return metrics_; }
+
+  const int n;
+
+ private:
+  bool running_;
+  uint64_t elapsed_;
+  uint64_t start_;
+  std::string metrics_;
+};
+
+struct Benchmark {
+  std::string name;
+  std::function<void(B&)> fn;
+};
+
+// Grows the iteration count like the Go testing package until a run takes
+// about kBenchmarkNanos
+void RunBenchmark(const Benchmark& benchmark) {
+  int n = 1;
+  for (;;) {
+    B b(n);
+    benchmark.fn(b);
+    b.StopTimer();
+
+    uint64_t elapsed = b.Elapsed() > 0 ? b.Elapsed() : 1;
+    if (elapsed >= kBenchmarkNanos || n >= 1000000000) {
+      printf("Benchmark%s\t%d\t%.1f ns/op%s\n", benchmark.name.c_str(), n,
+             static_cast<double>(elapsed) / n, b.Metrics().c_str());
+      fflush(stdout);
+      return;
+    }
+
+    uint64_t next = n * kBenchmarkNanos * 6 / 5 / elapsed;
+    if (next > 100ull * n) {
+      next = 100ull * n;
+    }
+    n = next > static_cast<uint64_t>(n) ? next : n + 1;
+  }
+}
+
+// Helpers
+
+void Check(RtnError error) {
+  if (error.msg != nullptr) {
+    fprintf(stderr, "%s\n%s\n", error.msg, error.stack ? error.stack : "");
+    exit(1);
+  }
+}
+
+ValuePtr MustRun(ContextPtr ctx, const std::string& source) {
+  RtnValue rtn = Run(ctx, source.data(), source.size(), "bench.js", 8);
+  if (rtn.error.msg != nullptr) {
+    Check(rtn.error);
+  }
+  return rtn.value;
+}
+
+const char* kSmallScript =
+    "(() => {\n"
+    "  const items = [3, 1, 4, 1, 5, 9, 2, 6];\n"
+    "  return items.map(x => x * 2).filter(x => x > 4)\n"
+    "      .reduce((a, b) => a + b, 0);\n"
+    "})()";
+
+// A script of roughly 1 MiB, in the range of a bundled application
+std::string LargeScript() {
+  std::string source;
+  for (int i = 0; source.size() < (1 << 20); i++) {
+    source += "function f" + std::to_string(i) + "(a, b) { return a * " +
+              std::to_string(i) + " + b; }\n";
+  }
+  source += "f0(1, 2);\n";
+  return source;
+}
+
+// Sources of n modules in load order, shaped like the graph of the Go
+// benchmarks
+std::vector<std::string> ModuleGraph(int n) {
+  std::vector<std::string> sources;
+  for (int i = 0; i < n; i++) {
+    if (i == 0) {
+      sources.push_back("export const v = 0;\n");
+      continue;
+    }
+    sources.push_back("import { v as a } from 'm" + std::to_string(i - 1) +
+                      "';\nimport { v as b } from 'm" +
+                      std::to_string(i / 2) +
+                      "';\nexport const v = a + b + " + std::to_string(i) +
+                      ";\n");
+  }
+  return sources;
+}
+
+// Benchmarks
+
+void AddRunBenchmarks(std::vector<Benchmark>* benchmarks,
+                      const std::string& name,
+                      const std::string& source) {
+  benchmarks->push_back({"Native/Run/" + name + "/Cached", [source](B& b) {
+                           b.StopTimer();
+                           ContextPtr ctx = NewContext(EngineConfig());
+                           b.StartTimer();
+                           for (int i = 0; i < b.n; i++) {
+                             DisposeValue(MustRun(ctx, source));
+                           }
+                           b.StopTimer();
+                           b.ReportPhases(ctx, kCallRun);
+                           DisposeContext(ctx);
+                         }});
+
+  benchmarks->push_back({"Native/Run/" + name + "/Uncached", [source](B& b) {
+                           b.StopTimer();
+                           ContextPtr ctx = NewContext(EngineConfig());
+                           // One buffer; only the trailing comment changes
+                           std::string unique = source + "\n// ";
+                           size_t prefix = unique.size();
+                           for (int i = 0; i < b.n; i++) {
+                             b.StopTimer();
+                             unique.resize(prefix);
+                             unique += std::to_string(i);
+                             b.StartTimer();
+                             DisposeValue(MustRun(ctx, unique));
+                           }
+                           b.StopTimer();
+                           b.ReportPhases(ctx, kCallRun);
+                           DisposeContext(ctx);
+                         }});
+}
+
+std::vector<Benchmark> Benchmarks() {
+  std::vector<Benchmark> benchmarks;
+
+  benchmarks.push_back({"Native/NewContext", [](B& b) {
+                          for (int i = 0; i < b.n; i++) {
+                            DisposeContext(NewContext(EngineConfig()));
+                          }
+                        }});
+
+  AddRunBenchmarks(&benchmarks, "Small", kSmallScript);
+  AddRunBenchmarks(&benchmarks, "Large", LargeScript());
+
+  for (int size : {16, 1 << 10, 64 << 10, 1 << 20}) {
+    benchmarks.push_back(
+        {"Native/Send/" + std::to_string(size) + "B", [size](B& b) {
+           b.StopTimer();
+           ContextPtr ctx = NewContext(EngineConfig());
+           DisposeValue(MustRun(ctx,
+                                "let received = 0;\n"
+                                "V8Engine.cb(buf => {\n"
+                                "  received += buf.byteLength;\n"
+                                "});"));
+           b.StartTimer();
+           for (int i = 0; i < b.n; i++) {
+             // Send takes ownership of the buffer, like C.CBytes in engine.go
+             void* data = calloc(1, size);
+             Check(Send(ctx, size, data));
+           }
+           b.StopTimer();
+           b.ReportPhases(ctx, kCallSend);
+           DisposeContext(ctx);
+         }});
+  }
+
+  for (int n : {10, 100, 1000}) {
+    benchmarks.push_back(
+        {"Native/LoadModule/" + std::to_string(n) + "Modules", [n](B& b) {
+           b.StopTimer();
+           std::vector<std::string> sources = ModuleGraph(n);
+           std::vector<std::string> names;
+           for (int j = 0; j < n; j++) {
+             names.push_back("m" + std::to_string(j));
+           }
+           for (int i = 0; i < b.n; i++) {
+             ContextPtr ctx = NewContext(EngineConfig());
+             b.StartTimer();
+             for (int j = 0; j < n; j++) {
+               Check(LoadModule(ctx, sources[j].data(), sources[j].size(),
+                                names[j].data(), names[j].size(), 0));
+             }
+             b.StopTimer();
+             DisposeContext(ctx);
+           }
+         }});
+  }
+
+  struct {
+    const char* name;
+    const char* source;
+  } values[] = {
+      {"Number", "42"},
+      {"String1KiB", "'x'.repeat(1024)"},
+      {"String1MiB", "'x'.repeat(1 << 20)"},
+  };
+  for (auto& value : values) {
+    std::string source = value.source;
+    benchmarks.push_back(
+        {std::string("Native/ValueToString/") + value.name, [source](B& b) {
+           b.StopTimer();
+           ContextPtr ctx = NewContext(EngineConfig());
+           ValuePtr val = MustRun(ctx, source);
+           b.StartTimer();
+           for (int i = 0; i < b.n; i++) {
+             free(const_cast<char*>(ValueToString(val)));
+           }
+           b.StopTimer();
+           b.ReportPhases(ctx, kCallValueToString);
+           DisposeValue(val);
+           DisposeContext(ctx);
+         }});
+  }
+
+  return benchmarks;
+}
+
+int main(int argc, char** argv) {
+  InitV8();
+
+  const char* filter = argc > 1 ? argv[1] : "";
+  for (const Benchmark& benchmark : Benchmarks()) {
+    if (benchmark.name.find(filter) != std::string::npos) {
+      RunBenchmark(benchmark);
+    }
+  }
+  return 0;
+}
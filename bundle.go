@@ -0,0 +1,121 @@
+package v8engine
+
+import (
+	"encoding/binary"
+	"fmt"
+	"math"
+	"sort"
+)
+
+const (
+	bundleVersion        = 1
+	bundleHeaderSize     = 16
+	bundleModuleSize     = 32
+	bundleDependencySize = 16
+)
+
+type bundleModule struct {
+	name         string
+	source       string
+	dependencies map[string]string
+	codeCache    []byte
+}
+
+// BundleBuilder assembles a module bundle: a single binary image holding many
+// modules with their dependencies already resolved, which LoadModuleBundle
+// loads without calling back into Go for every import
+type BundleBuilder struct {
+	modules []bundleModule
+	index   map[string]int
+}
+
+// NewBundleBuilder creates an empty module bundle
+func NewBundleBuilder() *BundleBuilder {
+	return &BundleBuilder{index: make(map[string]int)}
+}
+
+// Add adds a module to the bundle. dependencies maps every import specifier
+// used by source to the name of another module in the bundle. codeCache is
+// optional and can be created with Engine.ModuleCodeCache.
+func (b *BundleBuilder) Add(name, source string, dependencies map[string]string, codeCache []byte) {
+	if i, ok := b.index[name]; ok {
+		b.modules[i] = bundleModule{name, source, dependencies, codeCache}
+		return
+	}
+	b.index[name] = len(b.modules)
+	b.modules = append(b.modules, bundleModule{name, source, dependencies, codeCache})
+}
+
+// Bytes serializes the bundle. The same modules always serialize to the same
+// bytes. Bundles are limited to 4GiB.
+func (b *BundleBuilder) Bytes() ([]byte, error) {
+	depCount := 0
+	for _, m := range b.modules {
+		depCount += len(m.dependencies)
+	}
+
+	depsStart := bundleHeaderSize + len(b.modules)*bundleModuleSize
+	dataStart := depsStart + depCount*bundleDependencySize
+
+	buf := make([]byte, dataStart)
+	copy(buf, "V8MB")
+	binary.LittleEndian.PutUint32(buf[4:], bundleVersion)
+	binary.LittleEndian.PutUint32(buf[8:], uint32(len(b.modules)))
+
+	tooLarge := false
+	appendData := func(data []byte, align int) (uint32, uint32) {
+		for len(buf)%align != 0 {
+			buf = append(buf, 0)
+		}
+		off := len(buf)
+		buf = append(buf, data...)
+		if len(buf) > math.MaxUint32 {
+			tooLarge = true
+		}
+		return uint32(off), uint32(len(data))
+	}
+
+	depOff := depsStart
+	for i, m := range b.modules {
+		entry := bundleHeaderSize + i*bundleModuleSize
+		nameOff, nameLen := appendData([]byte(m.name), 1)
+		sourceOff, sourceLen := appendData([]byte(m.source), 1)
+		var cacheOff, cacheLen uint32
+		if len(m.codeCache) > 0 {
+			cacheOff, cacheLen = appendData(m.codeCache, 8)
+		}
+
+		binary.LittleEndian.PutUint32(buf[entry:], nameOff)
+		binary.LittleEndian.PutUint32(buf[entry+4:], nameLen)
+		binary.LittleEndian.PutUint32(buf[entry+8:], sourceOff)
+		binary.LittleEndian.PutUint32(buf[entry+12:], sourceLen)
+		binary.LittleEndian.PutUint32(buf[entry+16:], cacheOff)
+		binary.LittleEndian.PutUint32(buf[entry+20:], cacheLen)
+		binary.LittleEndian.PutUint32(buf[entry+24:], uint32(depOff))
+		binary.LittleEndian.PutUint32(buf[entry+28:], uint32(len(m.dependencies)))
+
+		specifiers := make([]string, 0, len(m.dependencies))
+		for specifier := range m.dependencies {
+			specifiers = append(specifiers, specifier)
+		}
+		sort.Strings(specifiers)
+
+		for _, specifier := range specifiers {
+			target := m.dependencies[specifier]
+			targetIndex, ok := b.index[target]
+			if !ok {
+				return nil, fmt.Errorf("module %q imports %q, which is not in the bundle", m.name, target)
+			}
+			specOff, specLen := appendData([]byte(specifier), 1)
+			binary.LittleEndian.PutUint32(buf[depOff:], specOff)
+			binary.LittleEndian.PutUint32(buf[depOff+4:], specLen)
+			binary.LittleEndian.PutUint32(buf[depOff+8:], uint32(targetIndex))
+			depOff += bundleDependencySize
+		}
+	}
+
+	if tooLarge {
+		return nil, fmt.Errorf("bundle of %d bytes exceeds the 4GiB limit", len(buf))
+	}
+	return buf, nil
+}
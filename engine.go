@@ -9,6 +9,8 @@ package v8engine
 import "C"
 
 import (
+	"context"
+	"errors"
 	"fmt"
 	"io"
 	"runtime"
@@ -21,19 +23,158 @@ var v8init sync.Once
 // Engine is a standalone instance of the V8 engine (isolate + context)
 type Engine struct {
 	contextPtr C.ContextPtr
+
+	// Accessed atomically, see SetIdle and IdleGC
+	idle     int32
+	idleDone int32
+
+	heapSamplingInterval int
+
+	log *logSink
+}
+
+// Option configures an engine created with NewEngine
+type Option func(*engineConfig)
+
+type engineConfig struct {
+	arrayBufferLimit int
+	hugePages        bool
+
+	initialOldGenerationSize   int
+	maxOldGenerationSize       int
+	initialYoungGenerationSize int
+	maxYoungGenerationSize     int
+
+	perfMap bool
+
+	logBufferSize int
+	logPolicy     LogPolicy
+	logStdout     io.Writer
+	logStderr     io.Writer
+
+	microtaskPolicy MicrotaskPolicy
+	microtaskQueue  bool
+}
+
+// WithArrayBufferLimit caps the bytes held by the engine's ArrayBuffers.
+// Allocations beyond the limit throw a RangeError in JavaScript.
+func WithArrayBufferLimit(bytes int) Option {
+	return func(c *engineConfig) {
+		c.arrayBufferLimit = bytes
+	}
+}
+
+// WithHugePages backs ArrayBuffers of 2 MiB and more with transparent huge
+// pages
+func WithHugePages() Option {
+	return func(c *engineConfig) {
+		c.hugePages = true
+	}
+}
+
+// WithOldGenerationSize sets the initial and maximum size of the old
+// generation heap in bytes. When a script exhausts the maximum it is
+// terminated and fails with an error matching ErrHeapLimitExceeded, instead
+// of the process running out of memory. 0 keeps V8's default.
+func WithOldGenerationSize(initial, max int) Option {
+	return func(c *engineConfig) {
+		c.initialOldGenerationSize = initial
+		c.maxOldGenerationSize = max
+	}
+}
+
+// WithYoungGenerationSize sets the initial and maximum size of the young
+// generation heap in bytes. 0 keeps V8's default.
+func WithYoungGenerationSize(initial, max int) Option {
+	return func(c *engineConfig) {
+		c.initialYoungGenerationSize = initial
+		c.maxYoungGenerationSize = max
+	}
+}
+
+// WithPerfMap writes the addresses and names of the engine's JIT-compiled
+// functions to /tmp/perf-<pid>.map, so perf record and perf top can
+// symbolize JavaScript frames. The map is shared by all engines in the
+// process.
+func WithPerfMap() Option {
+	return func(c *engineConfig) {
+		c.perfMap = true
+	}
+}
+
+// MicrotaskPolicy decides when promise jobs and other microtasks run
+type MicrotaskPolicy int
+
+// Microtask policies
+const (
+	// MicrotasksAuto runs microtasks whenever a call into the engine returns.
+	// This is the default.
+	MicrotasksAuto MicrotaskPolicy = C.kMicrotasksAuto
+	// MicrotasksExplicit only runs microtasks in PerformMicrotaskCheckpoint,
+	// so many calls can be batched before the jobs they queued run at once
+	MicrotasksExplicit MicrotaskPolicy = C.kMicrotasksExplicit
+	// MicrotasksScoped runs microtasks when an engine entry point (Run, Send,
+	// LoadModule, ...) returns, but not from nested calls into the engine
+	MicrotasksScoped MicrotaskPolicy = C.kMicrotasksScoped
+)
+
+// WithMicrotaskPolicy sets when the engine runs microtasks
+func WithMicrotaskPolicy(policy MicrotaskPolicy) Option {
+	return func(c *engineConfig) {
+		c.microtaskPolicy = policy
+	}
+}
+
+// WithMicrotaskQueue gives the engine's context a microtask queue of its own
+// rather than sharing the isolate's
+func WithMicrotaskQueue() Option {
+	return func(c *engineConfig) {
+		c.microtaskQueue = true
+	}
 }
 
 // NewEngine creates a new V8 engine (isolate + context)
-func NewEngine() *Engine {
+func NewEngine(opts ...Option) *Engine {
 	v8init.Do(func() {
 		C.InitV8()
 	})
 
-	contextPtr := C.NewContext()
+	var config engineConfig
+	for _, opt := range opts {
+		opt(&config)
+	}
+
+	cConfig := C.EngineConfig{
+		array_buffer_limit:            C.size_t(config.arrayBufferLimit),
+		initial_old_generation_size:   C.size_t(config.initialOldGenerationSize),
+		max_old_generation_size:       C.size_t(config.maxOldGenerationSize),
+		initial_young_generation_size: C.size_t(config.initialYoungGenerationSize),
+		max_young_generation_size:     C.size_t(config.maxYoungGenerationSize),
+	}
+	if config.hugePages {
+		cConfig.huge_pages = 1
+	}
+	if config.perfMap {
+		cConfig.perf_map = 1
+	}
+	if config.logBufferSize == 0 && (config.logStdout != nil || config.logStderr != nil) {
+		config.logBufferSize = DefaultLogBufferSize
+	}
+	cConfig.log_buffer_size = C.size_t(config.logBufferSize)
+	cConfig.log_policy = C.int(config.logPolicy)
+	cConfig.microtask_policy = C.int(config.microtaskPolicy)
+	if config.microtaskQueue {
+		cConfig.microtask_queue = 1
+	}
+
+	contextPtr := C.NewContext(cConfig)
 
 	engine := &Engine{
 		contextPtr: contextPtr,
 	}
+	if config.logBufferSize != 0 {
+		engine.log = newLogSink(contextPtr, &config)
+	}
 
 	runtime.SetFinalizer(engine, (*Engine).finalizer)
 
@@ -42,22 +183,56 @@ func NewEngine() *Engine {
 
 // Run executes a script in the engine, returning the result
 func (e *Engine) Run(source string, origin string) (*Value, error) {
-	cSource := C.CString(source)
+	rtn := C.Run(e.contextPtr, stringPtr(source), C.size_t(len(source)), stringPtr(origin), C.size_t(len(origin)))
+	return e.getValue(rtn), getError(rtn)
+}
+
+// RunFile executes the script stored in a file, returning the result. The file
+// is mapped into memory; large ASCII scripts are compiled straight from the
+// mapping without being copied. The file must not be truncated while the
+// engine is alive.
+func (e *Engine) RunFile(path string, origin string) (*Value, error) {
+	cPath := C.CString(path)
 	cOrigin := C.CString(origin)
-	defer C.free(unsafe.Pointer(cSource))
+	defer C.free(unsafe.Pointer(cPath))
 	defer C.free(unsafe.Pointer(cOrigin))
 
-	rtn := C.Run(e.contextPtr, cSource, cOrigin)
-	return getValue(rtn), getError(rtn)
+	rtn := C.RunFile(e.contextPtr, cPath, cOrigin)
+	return e.getValue(rtn), getError(rtn)
 }
 
-// LoadModule executes a script in the engine, returning the result
-func (e *Engine) LoadModule(source string, origin string, resolve ModuleResolverCallback) int {
-	cSource := C.CString(source)
-	cOrigin := C.CString(origin)
-	defer C.free(unsafe.Pointer(cSource))
-	defer C.free(unsafe.Pointer(cOrigin))
+// streamChunkSize is the size of the chunks RunStream hands to the parser.
+// Chunks are always full except for the last one, so multi-byte UTF-8
+// characters are never split across more than two chunks.
+const streamChunkSize = 64 * 1024
+
+// RunStream executes a script read from r, returning the result. The script is
+// parsed on a background thread while it is still being read.
+func (e *Engine) RunStream(r io.Reader, origin string) (*Value, error) {
+	stream := C.StartStream(e.contextPtr, stringPtr(origin), C.size_t(len(origin)))
+
+	buf := make([]byte, streamChunkSize)
+	for {
+		n, err := io.ReadFull(r, buf)
+		if n > 0 {
+			C.StreamPush(stream, (*C.char)(unsafe.Pointer(&buf[0])), C.size_t(n))
+		}
+		if err == io.EOF || err == io.ErrUnexpectedEOF {
+			break
+		}
+		if err != nil {
+			C.AbortStream(stream)
+			return nil, err
+		}
+	}
+
+	rtn := C.FinishStream(stream)
+	return e.getValue(rtn), getError(rtn)
+}
 
+// LoadModule compiles, links and evaluates a module in the engine. Failures
+// are returned as a *JSError.
+func (e *Engine) LoadModule(source string, origin string, resolve ModuleResolverCallback) error {
 	resolverTableLock.Lock()
 	nextResolverToken++
 	token := nextResolverToken
@@ -66,60 +241,182 @@ func (e *Engine) LoadModule(source string, origin string, resolve ModuleResolver
 
 	cToken := C.int(token)
 
-	rtn := C.LoadModule(e.contextPtr, cSource, cOrigin, cToken)
+	rtn := C.LoadModule(e.contextPtr, stringPtr(source), C.size_t(len(source)), stringPtr(origin), C.size_t(len(origin)), cToken)
 
 	resolverTableLock.Lock()
 	delete(resolverFuncs, token)
 	resolverTableLock.Unlock()
 
-	return int(rtn)
+	return getRtnError(rtn)
+}
+
+// LoadModuleBundle loads, links and evaluates every module of a bundle built
+// with BundleBuilder, in bundle order. Failures are returned as a *JSError.
+func (e *Engine) LoadModuleBundle(bundle []byte) error {
+	if len(bundle) == 0 {
+		return &JSError{Message: "BundleError: malformed module bundle"}
+	}
+
+	rtn := C.LoadModuleBundle(e.contextPtr, (*C.char)(unsafe.Pointer(&bundle[0])), C.size_t(len(bundle)))
+	return getRtnError(rtn)
+}
+
+// LoadModuleBundleFile loads a bundle stored in a file, like LoadModuleBundle.
+// The file is mapped into memory and large ASCII module sources are used in
+// place, so it must not be truncated while the engine is alive.
+func (e *Engine) LoadModuleBundleFile(path string) error {
+	cPath := C.CString(path)
+	defer C.free(unsafe.Pointer(cPath))
+
+	return getRtnError(C.LoadModuleBundleFile(e.contextPtr, cPath))
+}
+
+// ModuleCodeCache compiles a module without loading it and returns its code
+// cache, which can be added to a bundle to skip compilation when the bundle
+// is loaded. It returns nil if the module fails to compile.
+func (e *Engine) ModuleCodeCache(source string, origin string) []byte {
+	return getBytes(C.CompileModuleCodeCache(e.contextPtr, stringPtr(source), C.size_t(len(source)), stringPtr(origin), C.size_t(len(origin))))
+}
+
+// UnloadModule removes a module loaded with LoadModule from the module cache,
+// releasing its references to its dependencies. Modules that are still
+// imported by other loaded modules cannot be unloaded.
+func (e *Engine) UnloadModule(name string) error {
+	cName := C.CString(name)
+	defer C.free(unsafe.Pointer(cName))
+
+	switch C.UnloadModule(e.contextPtr, cName) {
+	case 0:
+		return nil
+	case 1:
+		return fmt.Errorf("module %q is not loaded", name)
+	default:
+		return fmt.Errorf("module %q is still imported by other modules", name)
+	}
+}
+
+// SetModuleCacheLimit caps the number of bytes retained by loaded modules.
+// Once the limit is exceeded, the least recently used modules that nothing
+// imports anymore are evicted. A limit of 0 disables eviction.
+func (e *Engine) SetModuleCacheLimit(bytes int) {
+	C.SetModuleCacheLimit(e.contextPtr, C.size_t(bytes))
+}
+
+// ModuleStats describes the modules retained by an engine
+type ModuleStats struct {
+	Count   int
+	Bytes   int
+	Limit   int
+	Evicted int
+}
+
+// ModuleStats returns the number of loaded modules and the (approximate)
+// number of bytes they retain
+func (e *Engine) ModuleStats() ModuleStats {
+	stats := C.GetModuleStats(e.contextPtr)
+	return ModuleStats{
+		Count:   int(stats.count),
+		Bytes:   int(stats.bytes),
+		Limit:   int(stats.limit),
+		Evicted: int(stats.evicted),
+	}
 }
 
-// Send sends bytes to V8
+// Send passes msg to the callback registered with V8Engine.cb as an
+// ArrayBuffer. An exception thrown by the callback is returned as a *JSError.
 func (e *Engine) Send(msg []byte) error {
 	msgPointer := C.CBytes(msg)
 
-	code := C.Send(e.contextPtr, C.size_t(len(msg)), msgPointer)
-	if code != 0 {
-		return fmt.Errorf("expected 0, got %d", code)
+	return getRtnError(C.Send(e.contextPtr, C.size_t(len(msg)), msgPointer))
+}
+
+// PerformMicrotaskCheckpoint runs the microtasks queued so far, such as
+// promise reactions, along with the microtasks they queue in turn
+func (e *Engine) PerformMicrotaskCheckpoint() {
+	C.PerformMicrotaskCheckpoint(e.contextPtr)
+}
+
+// ArrayBufferStats describes the memory held by an engine's ArrayBuffers
+type ArrayBufferStats struct {
+	Allocated int
+	Peak      int
+	Limit     int
+	Failed    int
+}
+
+// ArrayBufferStats returns the bytes currently allocated for ArrayBuffers, the
+// peak, the configured limit and the number of allocations that failed
+func (e *Engine) ArrayBufferStats() ArrayBufferStats {
+	stats := C.GetArrayBufferStats(e.contextPtr)
+	return ArrayBufferStats{
+		Allocated: int(stats.allocated),
+		Peak:      int(stats.peak),
+		Limit:     int(stats.limit),
+		Failed:    int(stats.failed),
 	}
-	return nil
 }
 
 func (e *Engine) finalizer() {
+	if e.log != nil {
+		e.log.close()
+	}
 	C.DisposeContext(e.contextPtr)
 	e.contextPtr = nil
 
 	runtime.SetFinalizer(e, nil)
 }
 
-func getValue(rtn C.RtnValue) *Value {
+func (e *Engine) getValue(rtn C.RtnValue) *Value {
 	if rtn.value == nil {
 		return nil
 	}
-	v := &Value{rtn.value}
+	v := &Value{rtn.value, e}
 	runtime.SetFinalizer(v, (*Value).finalizer)
 	return v
 }
 
+// stringPtr returns a pointer to the bytes of s, to be passed to C along with
+// len(s) for the duration of a call. String data holds no Go pointers, so it
+// can be passed without copying it into a C string first.
+func stringPtr(s string) *C.char {
+	return (*C.char)(unsafe.Pointer(unsafe.StringData(s)))
+}
+
+func getBytes(rtn C.RtnBytes) []byte {
+	if rtn.data == nil {
+		return nil
+	}
+	b := C.GoBytes(unsafe.Pointer(rtn.data), C.int(rtn.length))
+	C.free(unsafe.Pointer(rtn.data))
+	return b
+}
+
 func getError(rtn C.RtnValue) error {
-	if rtn.error.msg == nil {
+	return getRtnError(rtn.error)
+}
+
+func getRtnError(rtn C.RtnError) error {
+	if rtn.msg == nil {
 		return nil
 	}
 	err := &JSError{
-		Message:    C.GoString(rtn.error.msg),
-		Location:   C.GoString(rtn.error.location),
-		StackTrace: C.GoString(rtn.error.stack),
+		Message:    C.GoString(rtn.msg),
+		Location:   C.GoString(rtn.location),
+		StackTrace: C.GoString(rtn.stack),
+		kind:       int(rtn.kind),
 	}
-	C.free(unsafe.Pointer(rtn.error.msg))
-	C.free(unsafe.Pointer(rtn.error.location))
-	C.free(unsafe.Pointer(rtn.error.stack))
+	C.free(unsafe.Pointer(rtn.msg))
+	C.free(unsafe.Pointer(rtn.location))
+	C.free(unsafe.Pointer(rtn.stack))
 	return err
 }
 
 // Value represents a JavaScript value
 type Value struct {
 	ptr C.ValuePtr
+
+	// Keeps the engine alive, so it is never disposed before its values
+	engine *Engine
 }
 
 // String returns the string representation of the value
@@ -177,12 +474,41 @@ type JSError struct {
 	Message    string
 	Location   string
 	StackTrace string
+
+	kind int
 }
 
+var (
+	// ErrExecutionTerminated is matched by errors of scripts whose execution
+	// was terminated
+	ErrExecutionTerminated = errors.New("v8engine: execution terminated")
+
+	// ErrHeapLimitExceeded is matched by errors of scripts that were
+	// terminated because the engine reached its heap limit
+	ErrHeapLimitExceeded = errors.New("v8engine: heap limit exceeded")
+)
+
 func (e *JSError) Error() string {
 	return e.Message
 }
 
+// Is reports whether the error matches ErrExecutionTerminated or
+// ErrHeapLimitExceeded, or, for awaits that ended early,
+// context.DeadlineExceeded or context.Canceled, for use with errors.Is
+func (e *JSError) Is(target error) bool {
+	switch target {
+	case ErrExecutionTerminated:
+		return e.kind == C.kErrorTerminated || e.kind == C.kErrorHeapLimit
+	case ErrHeapLimitExceeded:
+		return e.kind == C.kErrorHeapLimit
+	case context.DeadlineExceeded:
+		return e.kind == C.kErrorDeadline
+	case context.Canceled:
+		return e.kind == C.kErrorCanceled
+	}
+	return false
+}
+
 // Format implements the fmt.Formatter interface to provide a custom formatter
 // primarily to output the javascript stack trace with %+v
 func (e *JSError) Format(s fmt.State, verb rune) {
@@ -0,0 +1,260 @@
+package v8engine
+
+// Benchmarks for the engine API. Compare two revisions with benchstat:
+//
+//	go test -run '^$' -bench . -count 10 > old.txt
+//	go test -run '^$' -bench . -count 10 > new.txt
+//	benchstat old.txt new.txt
+//
+// Engines that have handed out Values are left to the garbage collector, as a
+// Value must not outlive its engine. The others are disposed right away.
+
+import (
+	"fmt"
+	"strings"
+	"sync/atomic"
+	"testing"
+)
+
+const smallScript = `(() => {
+	const items = [3, 1, 4, 1, 5, 9, 2, 6];
+	return items.map(x => x * 2).filter(x => x > 4).reduce((a, b) => a + b, 0);
+})()`
+
+// A script of roughly 1 MiB, in the range of a bundled application
+var largeScript = func() string {
+	var sb strings.Builder
+	for i := 0; sb.Len() < 1<<20; i++ {
+		fmt.Fprintf(&sb, "function f%d(a, b) { return a * %d + b; }\n", i, i)
+	}
+	sb.WriteString("f0(1, 2);\n")
+	return sb.String()
+}()
+
+var uniqueScripts int64
+
+// uniqueScript returns a variant of source that misses V8's compilation cache
+func uniqueScript(source string) string {
+	return fmt.Sprintf("%s\n// %d", source, atomic.AddInt64(&uniqueScripts, 1))
+}
+
+func BenchmarkNewEngine(b *testing.B) {
+	NewEngine() // Initialize V8 outside of the measurement
+	b.ReportAllocs()
+	for i := 0; i < b.N; i++ {
+		e := NewEngine()
+		e.finalizer()
+	}
+}
+
+func BenchmarkRun(b *testing.B) {
+	for _, bm := range []struct {
+		name   string
+		source string
+	}{
+		{"Small", smallScript},
+		{"Large", largeScript},
+	} {
+		b.Run(bm.name+"/Cached", func(b *testing.B) {
+			e := NewEngine()
+			b.SetBytes(int64(len(bm.source)))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if _, err := e.Run(bm.source, "bench.js"); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+
+		b.Run(bm.name+"/Uncached", func(b *testing.B) {
+			e := NewEngine()
+			b.SetBytes(int64(len(bm.source)))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				// Only one copy of the source is alive at a time
+				b.StopTimer()
+				source := uniqueScript(bm.source)
+				b.StartTimer()
+				if _, err := e.Run(source, "bench.js"); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+func newSendEngine(b *testing.B) *Engine {
+	e := NewEngine()
+	_, err := e.Run(`
+		let received = 0;
+		V8Engine.cb(buf => { received += buf.byteLength; });
+	`, "send.js")
+	if err != nil {
+		b.Fatal(err)
+	}
+	return e
+}
+
+func BenchmarkSend(b *testing.B) {
+	for _, size := range []int{16, 1 << 10, 64 << 10, 1 << 20} {
+		b.Run(fmt.Sprintf("%dB", size), func(b *testing.B) {
+			e := newSendEngine(b)
+			msg := make([]byte, size)
+			b.SetBytes(int64(size))
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				if err := e.Send(msg); err != nil {
+					b.Fatal(err)
+				}
+			}
+		})
+	}
+}
+
+// moduleGraph returns the sources of n modules in load order. Every module
+// imports the one before it and the one at half its index, so the graph is
+// both deep and shared.
+func moduleGraph(n int) []string {
+	sources := make([]string, n)
+	for i := range sources {
+		var sb strings.Builder
+		if i > 0 {
+			fmt.Fprintf(&sb, "import { v as a } from 'm%d';\n", i-1)
+			fmt.Fprintf(&sb, "import { v as b } from 'm%d';\n", i/2)
+			fmt.Fprintf(&sb, "export const v = a + b + %d;\n", i)
+		} else {
+			sb.WriteString("export const v = 0;\n")
+		}
+		sources[i] = sb.String()
+	}
+	return sources
+}
+
+func BenchmarkLoadModule(b *testing.B) {
+	resolve := func(specifier, referrer string) (string, int) {
+		return specifier, 0
+	}
+
+	for _, n := range []int{10, 100, 1000} {
+		b.Run(fmt.Sprintf("%dModules", n), func(b *testing.B) {
+			sources := moduleGraph(n)
+			b.ReportAllocs()
+			for i := 0; i < b.N; i++ {
+				b.StopTimer()
+				e := NewEngine()
+				b.StartTimer()
+
+				for j, source := range sources {
+					if err := e.LoadModule(source, fmt.Sprintf("m%d", j), resolve); err != nil {
+						b.Fatal(err)
+					}
+				}
+
+				b.StopTimer()
+				e.finalizer()
+				b.StartTimer()
+			}
+		})
+	}
+}
+
+func BenchmarkValueToString(b *testing.B) {
+	for _, bm := range []struct {
+		name   string
+		source string
+	}{
+		{"Number", "42"},
+		{"String1KiB", "'x'.repeat(1024)"},
+		{"String1MiB", "'x'.repeat(1 << 20)"},
+	} {
+		b.Run(bm.name, func(b *testing.B) {
+			e := NewEngine()
+			v, err := e.Run(bm.source, "value.js")
+			if err != nil {
+				b.Fatal(err)
+			}
+			b.ReportAllocs()
+			b.ResetTimer()
+			for i := 0; i < b.N; i++ {
+				_ = v.String()
+			}
+		})
+	}
+}
+
+// BenchmarkEvaluate compares calling a precompiled function with running a
+// new script per event
+func BenchmarkEvaluate(b *testing.B) {
+	const rule = "return event.score > 10 && event.tags.includes('x');"
+
+	b.Run("Run", func(b *testing.B) {
+		e := NewEngine()
+		if _, err := e.Run("function evaluate(event) { "+rule+" }", "rule.js"); err != nil {
+			b.Fatal(err)
+		}
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			source := fmt.Sprintf(`evaluate({"score": %d, "tags": ["x"]})`, i)
+			if _, err := e.Run(source, "event.js"); err != nil {
+				b.Fatal(err)
+			}
+		}
+	})
+
+	b.Run("Function", func(b *testing.B) {
+		e := NewEngine()
+		f, err := e.CompileFunction([]string{"event"}, rule, "rule.js")
+		if err != nil {
+			b.Fatal(err)
+		}
+		parse, err := e.CompileFunction([]string{"json"}, "return JSON.parse(json);", "parse.js")
+		if err != nil {
+			b.Fatal(err)
+		}
+		b.ReportAllocs()
+		for i := 0; i < b.N; i++ {
+			event, err := parse.Call(fmt.Sprintf(`{"score": %d, "tags": ["x"]}`, i))
+			if err != nil {
+				b.Fatal(err)
+			}
+			if _, err := f.Call(event); err != nil {
+				b.Fatal(err)
+			}
+		}
+	})
+}
+
+// BenchmarkParallel runs scripts on one engine per goroutine, across
+// GOMAXPROCS goroutines
+func BenchmarkParallel(b *testing.B) {
+	b.Run("Run", func(b *testing.B) {
+		b.ReportAllocs()
+		b.RunParallel(func(pb *testing.PB) {
+			e := NewEngine()
+			for pb.Next() {
+				if _, err := e.Run(smallScript, "bench.js"); err != nil {
+					b.Error(err)
+					return
+				}
+			}
+		})
+	})
+
+	b.Run("Send", func(b *testing.B) {
+		msg := make([]byte, 1<<10)
+		b.SetBytes(int64(len(msg)))
+		b.ReportAllocs()
+		b.RunParallel(func(pb *testing.PB) {
+			e := newSendEngine(b)
+			for pb.Next() {
+				if err := e.Send(msg); err != nil {
+					b.Error(err)
+					return
+				}
+			}
+		})
+	})
+}
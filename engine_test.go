@@ -0,0 +1,582 @@
+package v8engine
+
+import (
+	"bytes"
+	"context"
+	"errors"
+	"fmt"
+	"os"
+	"path/filepath"
+	"strings"
+	"sync"
+	"testing"
+	"time"
+)
+
+func resolveSame(specifier, referrer string) (string, int) {
+	return specifier, 0
+}
+
+func loadModules(t *testing.T, e *Engine, modules [][2]string) {
+	t.Helper()
+	for _, m := range modules {
+		if err := e.LoadModule(m[1], m[0], resolveSame); err != nil {
+			t.Fatalf("loading %s: %v", m[0], err)
+		}
+	}
+}
+
+func TestUnloadModule(t *testing.T) {
+	for _, tc := range []struct {
+		name string
+		// Loaded after a and b, and expected to fail
+		failing [2]string
+		unload  []string
+		wantErr bool
+		count   int
+	}{
+		{"leaf", [2]string{}, []string{"b"}, false, 1},
+		{"imported", [2]string{}, []string{"a"}, true, 2},
+		{"dependent first", [2]string{}, []string{"b", "a"}, false, 0},
+		{"missing", [2]string{}, []string{"c"}, true, 2},
+		// A failed importer leaves no reference on a behind
+		{"failed instantiate", [2]string{"c", "import { nope } from 'a';"}, []string{"b", "a"}, false, 0},
+		{"failed evaluate", [2]string{"c", "import { a } from 'a'; throw new Error(a);"}, []string{"b", "a"}, false, 0},
+		// A failed reload keeps the working b, which still imports a
+		{"failed reload", [2]string{"b", "throw new Error('b');"}, []string{"a"}, true, 2},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			loadModules(t, e, [][2]string{
+				{"a", "export const a = 1;"},
+				{"b", "import { a } from 'a'; export const b = a;"},
+			})
+			if tc.failing[0] != "" {
+				if err := e.LoadModule(tc.failing[1], tc.failing[0], resolveSame); err == nil {
+					t.Fatalf("loading %s succeeded", tc.failing[0])
+				}
+			}
+
+			var err error
+			for _, name := range tc.unload {
+				err = e.UnloadModule(name)
+			}
+			if (err != nil) != tc.wantErr {
+				t.Fatalf("UnloadModule: %v", err)
+			}
+			if count := e.ModuleStats().Count; count != tc.count {
+				t.Fatalf("%d modules loaded, want %d", count, tc.count)
+			}
+		})
+	}
+}
+
+func TestModuleEviction(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		limit   int
+		count   int
+		evicted int
+	}{
+		{"unlimited", 0, 3, 0},
+		{"large", 1 << 20, 3, 0},
+		// Evicting c releases b, and then a, in the same call
+		{"chain", 1, 0, 3},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			loadModules(t, e, [][2]string{
+				{"a", "export const a = 1;"},
+				{"b", "import { a } from 'a'; export const b = a;"},
+				{"c", "import { b } from 'b'; export const c = b;"},
+			})
+
+			e.SetModuleCacheLimit(tc.limit)
+			stats := e.ModuleStats()
+			if stats.Count != tc.count || stats.Evicted != tc.evicted {
+				t.Fatalf("got %+v, want %d modules and %d evicted", stats, tc.count, tc.evicted)
+			}
+			if tc.limit > 0 && stats.Count > 0 && stats.Bytes > tc.limit {
+				t.Fatalf("%d bytes retained over the limit of %d", stats.Bytes, tc.limit)
+			}
+		})
+	}
+}
+
+func TestLoadModuleBundle(t *testing.T) {
+	aDeps := map[string]string{"./a": "a"}
+	for _, tc := range []struct {
+		name     string
+		source   string
+		deps     map[string]string
+		dupe     bool
+		truncate int
+		wantErr  bool
+		count    int
+		a        string
+	}{
+		{"ok", "import { a } from './a'; export const b = a;", aDeps, false, 0, false, 2, "1"},
+		{"syntax error", "import { a } from './a'; export const b = ;", aDeps, false, 0, true, 1, "0"},
+		{"throws", "import { a } from './a'; throw new Error(a);", aDeps, false, 0, true, 1, "0"},
+		{"missing dependency", "import { a } from './a'; export const b = a;", nil, false, 0, true, 1, "0"},
+		{"unknown export", "import { nope } from './a';", aDeps, false, 0, true, 1, "0"},
+		{"duplicate name", "export const b = 1;", nil, true, 0, true, 1, "0"},
+		{"truncated", "import { a } from './a'; export const b = a;", aDeps, false, 8, true, 1, "0"},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			b := NewBundleBuilder()
+			b.Add("a", "export const a = 1;", nil, nil)
+			b.Add("b", tc.source, tc.deps, nil)
+			bundle, err := b.Bytes()
+			if err != nil {
+				t.Fatal(err)
+			}
+			if tc.dupe {
+				// The builder replaces modules added twice, so b is renamed
+				// to a in place. Its name is stored right before its source.
+				bundle[bytes.Index(bundle, []byte("bexport const b"))] = 'a'
+			}
+			bundle = bundle[:len(bundle)-tc.truncate]
+
+			e := NewEngine()
+			loadModules(t, e, [][2]string{{"a", "export const a = 0;"}})
+			if err := e.LoadModuleBundle(bundle); (err != nil) != tc.wantErr {
+				t.Fatalf("LoadModuleBundle: %v", err)
+			}
+
+			// A failed bundle leaves the loaded modules as they were
+			if count := e.ModuleStats().Count; count != tc.count {
+				t.Fatalf("%d modules loaded, want %d", count, tc.count)
+			}
+			loadModules(t, e, [][2]string{{"check", "import { a } from 'a'; globalThis.seen = a;"}})
+			if v, _ := e.Run("seen", "check.js"); v.String() != tc.a {
+				t.Fatalf("a is %v, want %s", v, tc.a)
+			}
+		})
+	}
+}
+
+func TestBundleBytesDeterministic(t *testing.T) {
+	build := func() []byte {
+		b := NewBundleBuilder()
+		b.Add("a", "export const a = 1;", nil, nil)
+		b.Add("b", "export const b = 2;", nil, nil)
+		b.Add("c", "import { a } from './a'; import { b } from './b'; import { c } from './c';",
+			map[string]string{"./a": "a", "./b": "b", "./c": "c"}, nil)
+		bundle, err := b.Bytes()
+		if err != nil {
+			t.Fatal(err)
+		}
+		return bundle
+	}
+
+	want := build()
+	for i := 0; i < 10; i++ {
+		if !bytes.Equal(build(), want) {
+			t.Fatal("serializing the same bundle twice gave different bytes")
+		}
+	}
+}
+
+func TestRunStream(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		source  string
+		want    string
+		wantErr bool
+	}{
+		{"small", "1 + 2", "3", false},
+		// Spans several chunks, and is large enough for an external string
+		{"ascii", strings.Repeat("var x = 'hello world'; ", 20000) + "x.length", "11", false},
+		{"utf-8", strings.Repeat("var x = 'héllo wörld ✓'; ", 20000) + "x.length", "13", false},
+		{"empty", "", "undefined", false},
+		{"syntax error", "var =", "", true},
+		{"throws", "throw new Error('x')", "", true},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			v, err := e.RunStream(strings.NewReader(tc.source), "stream.js")
+			if (err != nil) != tc.wantErr {
+				t.Fatalf("RunStream: %v", err)
+			}
+			if err == nil && v.String() != tc.want {
+				t.Fatalf("got %q, want %q", v.String(), tc.want)
+			}
+		})
+	}
+}
+
+func TestHugePageBuffers(t *testing.T) {
+	for _, tc := range []struct {
+		name string
+		size int
+	}{
+		{"small", 4096},
+		{"exact", 2 << 20},
+		{"unaligned", 5<<20 + 123},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine(WithHugePages())
+			// Touch both ends of the buffer, then free it
+			script := fmt.Sprintf(`(() => {
+				const b = new Uint8Array(%d);
+				b[0] = 1; b[b.length - 1] = 2;
+				return b[0] + b[b.length - 1] + b[1];
+			})()`, tc.size)
+			for i := 0; i < 3; i++ {
+				v, err := e.Run(script, "huge.js")
+				if err != nil || v.String() != "3" {
+					t.Fatalf("got %v, %v", v, err)
+				}
+			}
+		})
+	}
+}
+
+func TestPressureMonitorStop(t *testing.T) {
+	for _, tc := range []struct {
+		name  string
+		start bool
+		stops int
+	}{
+		{"never started", false, 1},
+		{"started", true, 1},
+		{"stopped twice", true, 2},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			m := NewPressureMonitor()
+			if tc.start {
+				if err := m.Start(); err != nil {
+					t.Skipf("no pressure information: %v", err)
+				}
+			}
+			for i := 0; i < tc.stops; i++ {
+				m.Stop()
+			}
+		})
+	}
+}
+
+// lockedBuffer is a bytes.Buffer safe for use by the log drainer
+type lockedBuffer struct {
+	mu  sync.Mutex
+	buf bytes.Buffer
+}
+
+func (b *lockedBuffer) Write(p []byte) (int, error) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.Write(p)
+}
+
+func (b *lockedBuffer) String() string {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	return b.buf.String()
+}
+
+func TestLogDropAccounting(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		size    int
+		policy  LogPolicy
+		line    int
+		mayDrop bool
+	}{
+		// Sizes below a record header are rounded up rather than underflowing
+		{"tiny", 1, LogDrop, 20, true},
+		{"header", 5, LogDrop, 20, true},
+		{"small", 256, LogDrop, 20, true},
+		{"truncated", 64, LogDrop, 100, true},
+		{"large", 1 << 20, LogDrop, 20, false},
+		{"tiny blocking", 1, LogBlock, 20, false},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			var out lockedBuffer
+			e := NewEngine(WithLogBuffer(tc.size, tc.policy), WithLogOutput(&out, &out))
+			script := fmt.Sprintf(`for (let i = 0; i < 100; i++) V8Engine.print("x".repeat(%d))`, tc.line)
+			if _, err := e.Run(script, "log.js"); err != nil {
+				t.Fatal(err)
+			}
+			e.FlushLog()
+
+			lines := strings.Count(out.String(), "\n")
+			dropped := e.DroppedLogLines()
+			if lines+dropped != 100 {
+				t.Fatalf("%d lines written and %d dropped, want 100 in all", lines, dropped)
+			}
+			if dropped > 0 && !tc.mayDrop {
+				t.Fatalf("%d lines dropped", dropped)
+			}
+		})
+	}
+}
+
+func TestSend(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		cb      string
+		wantErr string
+	}{
+		{"no callback", "", "SendError"},
+		{"ok", "V8Engine.cb(buf => buf.byteLength)", ""},
+		{"throws", "V8Engine.cb(buf => { throw new Error('nope') })", "nope"},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			if _, err := e.Run(tc.cb, "cb.js"); err != nil {
+				t.Fatal(err)
+			}
+
+			err := e.Send([]byte{1, 2, 3})
+			if tc.wantErr == "" && err != nil {
+				t.Fatalf("Send: %v", err)
+			}
+			if tc.wantErr != "" && (err == nil || !strings.Contains(err.Error(), tc.wantErr)) {
+				t.Fatalf("got %v, want an error containing %q", err, tc.wantErr)
+			}
+		})
+	}
+}
+
+func TestRunAwaitDeadline(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		source  string
+		timeout time.Duration
+		want    string
+		wantErr error
+	}{
+		{"settles first", "new Promise(r => setTimeout(() => r(1), 5))", time.Second, "1", nil},
+		{"never settles", "new Promise(() => {})", 30 * time.Millisecond, "", context.DeadlineExceeded},
+		{"timer after deadline", "new Promise(r => setTimeout(r, 5000))", 30 * time.Millisecond, "", context.DeadlineExceeded},
+		// Results that are not promises are returned even past the deadline
+		{"not a promise", "1 + 1", 0, "2", nil},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			ctx, cancel := context.WithTimeout(context.Background(), tc.timeout)
+			defer cancel()
+
+			start := time.Now()
+			v, err := e.RunAwait(ctx, tc.source, "await.js")
+			if err != tc.wantErr {
+				t.Fatalf("got %v, want %v", err, tc.wantErr)
+			}
+			if err == nil && v.String() != tc.want {
+				t.Fatalf("got %q, want %q", v.String(), tc.want)
+			}
+			if elapsed := time.Since(start); tc.timeout > 0 && elapsed > tc.timeout+time.Second {
+				t.Fatalf("returned after %v, past the %v deadline", elapsed, tc.timeout)
+			}
+		})
+	}
+}
+
+func TestCompileFunction(t *testing.T) {
+	for _, tc := range []struct {
+		name    string
+		params  []string
+		body    string
+		args    []interface{}
+		want    string
+		wantErr string
+	}{
+		{"params", []string{"a", "b"}, "return a + b", []interface{}{"x", 1}, "x1", ""},
+		{"no params", nil, "return 7", nil, "7", ""},
+		{"invalid name", []string{"1x"}, "return 1", nil, "", "SyntaxError"},
+		{"spaced name", []string{"a", " b"}, "return a", nil, "", "SyntaxError"},
+		// A comma does not split a name into two parameters
+		{"comma in name", []string{"a,b"}, "return a", nil, "", "SyntaxError"},
+		{"body error", []string{"a"}, "return a +", nil, "", "SyntaxError"},
+		{"throws", nil, "throw new RangeError('nope')", nil, "", "nope"},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			f, err := e.CompileFunction(tc.params, tc.body, "f.js")
+			var v *Value
+			if err == nil {
+				v, err = f.Call(tc.args...)
+			}
+			if tc.wantErr != "" {
+				if err == nil || !strings.Contains(err.Error(), tc.wantErr) {
+					t.Fatalf("got %v, want an error containing %q", err, tc.wantErr)
+				}
+				return
+			}
+			if err != nil {
+				t.Fatal(err)
+			}
+			if v.String() != tc.want {
+				t.Fatalf("got %q, want %q", v.String(), tc.want)
+			}
+		})
+	}
+}
+
+func TestGetSetMany(t *testing.T) {
+	for _, tc := range []struct {
+		name  string
+		value interface{}
+		want  interface{}
+	}{
+		{"number", 1.5, 1.5},
+		{"integer", 7, 7.0},
+		{"string", "héllo", "héllo"},
+		{"empty string", "", ""},
+		{"boolean", true, true},
+		{"null", nil, nil},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			e := NewEngine()
+			keys := []Key{e.InternKey("a"), e.InternKey("b")}
+			obj := e.NewObject()
+			// Strings of neighbouring values share the buffer passed to C
+			if err := obj.SetMany(keys, []interface{}{tc.value, "tail"}); err != nil {
+				t.Fatal(err)
+			}
+
+			got, err := obj.GetMany(keys...)
+			if err != nil {
+				t.Fatal(err)
+			}
+			if got[0] != tc.want || got[1] != "tail" {
+				t.Fatalf("got %v, want [%v tail]", got, tc.want)
+			}
+		})
+	}
+}
+
+func TestSetGlobalsMicrotasks(t *testing.T) {
+	e := NewEngine(WithMicrotaskPolicy(MicrotasksScoped))
+	if _, err := e.Run(`Object.defineProperty(globalThis, "m", {
+		set(v) { Promise.resolve().then(() => globalThis.ran = v) }
+	})`, "m.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	// Microtasks queued by a setter run before SetGlobals returns
+	if err := e.SetGlobals(map[Key]interface{}{e.InternKey("m"): 5}); err != nil {
+		t.Fatal(err)
+	}
+	if v, _ := e.Run("globalThis.ran", "m.js"); v.String() != "5" {
+		t.Fatalf("got %v, want 5", v)
+	}
+}
+
+// addWasm exports add(a, b i32) i32
+var addWasm = []byte{0x00, 0x61, 0x73, 0x6d, 0x01, 0x00, 0x00, 0x00,
+	0x01, 0x07, 0x01, 0x60, 0x02, 0x7f, 0x7f, 0x01, 0x7f,
+	0x03, 0x02, 0x01, 0x00,
+	0x07, 0x07, 0x01, 0x03, 0x61, 0x64, 0x64, 0x00, 0x00,
+	0x0a, 0x09, 0x01, 0x07, 0x00, 0x20, 0x00, 0x20, 0x01, 0x6a, 0x0b}
+
+func TestWasmCache(t *testing.T) {
+	for _, tc := range []struct {
+		name string
+		// Runs between the two compiles, with the cache directory
+		between  func(t *testing.T, dir string)
+		noDir    bool
+		hits     int
+		diskHits int
+	}{
+		{"memory hit", func(t *testing.T, dir string) {}, false, 1, 0},
+		{"disk hit", func(t *testing.T, dir string) { ClearWasmCache() }, false, 0, 1},
+		{"no directory", func(t *testing.T, dir string) { ClearWasmCache() }, true, 0, 0},
+		{"stale file", func(t *testing.T, dir string) {
+			ClearWasmCache()
+			rewriteWasmCache(t, dir, func(b []byte) []byte { return []byte("stale") })
+		}, false, 0, 0},
+		{"corrupt file", func(t *testing.T, dir string) {
+			ClearWasmCache()
+			rewriteWasmCache(t, dir, func(b []byte) []byte {
+				b[len(b)-1] ^= 0xff
+				return b
+			})
+		}, false, 0, 0},
+	} {
+		t.Run(tc.name, func(t *testing.T) {
+			dir := t.TempDir()
+			if !tc.noDir {
+				SetWasmCacheDir(dir)
+				defer SetWasmCacheDir("")
+			}
+			ClearWasmCache()
+			before := GetWasmCacheStats()
+
+			compile := func() {
+				t.Helper()
+				e := NewEngine()
+				m, err := e.CompileWasm(addWasm)
+				if err != nil {
+					t.Fatal(err)
+				}
+				f, err := e.CompileFunction([]string{"m"}, "return new WebAssembly.Instance(m).exports.add(2, 3)", "wasm.js")
+				if err != nil {
+					t.Fatal(err)
+				}
+				if v, err := f.Call(m.Value); err != nil || v.String() != "5" {
+					t.Fatalf("got %v, %v", v, err)
+				}
+			}
+			compile()
+			tc.between(t, dir)
+			compile()
+
+			stats := GetWasmCacheStats()
+			if hits := stats.Hits - before.Hits; hits != tc.hits {
+				t.Fatalf("%d memory hits, want %d", hits, tc.hits)
+			}
+			if diskHits := stats.DiskHits - before.DiskHits; diskHits != tc.diskHits {
+				t.Fatalf("%d disk hits, want %d", diskHits, tc.diskHits)
+			}
+
+			// Stale and corrupt files are replaced by the second compile
+			if !tc.noDir {
+				ClearWasmCache()
+				before = GetWasmCacheStats()
+				compile()
+				if diskHits := GetWasmCacheStats().DiskHits - before.DiskHits; diskHits != 1 {
+					t.Fatalf("cache file not usable after the second compile")
+				}
+			}
+		})
+	}
+}
+
+// rewriteWasmCache replaces the single cache file in dir with fn of its
+// contents
+func rewriteWasmCache(t *testing.T, dir string, fn func([]byte) []byte) {
+	t.Helper()
+	files, err := filepath.Glob(filepath.Join(dir, "*.wasmcache"))
+	if err != nil || len(files) != 1 {
+		t.Fatalf("cache files %v, %v", files, err)
+	}
+	b, err := os.ReadFile(files[0])
+	if err != nil {
+		t.Fatal(err)
+	}
+	if err := os.WriteFile(files[0], fn(b), 0644); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestHeapLimit(t *testing.T) {
+	e := NewEngine(WithOldGenerationSize(0, 32<<20))
+	_, err := e.Run("var keep = []; while (true) keep.push(new Array(100).fill(1));", "oom.js")
+	if !errors.Is(err, ErrHeapLimitExceeded) || !errors.Is(err, ErrExecutionTerminated) {
+		t.Fatalf("got %v, want ErrHeapLimitExceeded", err)
+	}
+
+	// The engine stays usable once the garbage is released
+	if _, err := e.Run("keep = null", "free.js"); err != nil {
+		t.Fatal(err)
+	}
+	v, err := e.Run("new Array(1000).fill(1).length", "after.js")
+	if err != nil || v.String() != "1000" {
+		t.Fatalf("got %v, %v after the heap limit", v, err)
+	}
+	if _, err := e.Run("throw new Error('plain')", "after.js"); errors.Is(err, ErrHeapLimitExceeded) {
+		t.Fatalf("later errors still report the heap limit: %v", err)
+	}
+}
@@ -0,0 +1,180 @@
+package v8engine
+
+// #include <stdlib.h>
+// #include "v8engine.h"
+import "C"
+
+import (
+	"fmt"
+	"runtime"
+	"unsafe"
+)
+
+// Function is a JavaScript function compiled once with CompileFunction and
+// called as many times as needed, without parsing its source again
+type Function struct {
+	*Value
+
+	cache         []byte
+	cacheRejected bool
+}
+
+// FunctionOption configures CompileFunction
+type FunctionOption func(*functionConfig)
+
+type functionConfig struct {
+	cache        []byte
+	produceCache bool
+}
+
+// WithFunctionCache consumes a code cache returned by Function.CodeCache for
+// the same parameters and body, skipping compilation
+func WithFunctionCache(cache []byte) FunctionOption {
+	return func(c *functionConfig) {
+		c.cache = cache
+	}
+}
+
+// WithProduceFunctionCache makes Function.CodeCache return the function's
+// code cache
+func WithProduceFunctionCache() FunctionOption {
+	return func(c *functionConfig) {
+		c.produceCache = true
+	}
+}
+
+// CompileFunction compiles body as the body of a function taking params, in
+// the engine's global scope. Compile errors are returned as a *JSError.
+func (e *Engine) CompileFunction(params []string, body string, origin string, opts ...FunctionOption) (*Function, error) {
+	var config functionConfig
+	for _, opt := range opts {
+		opt(&config)
+	}
+
+	// Names are passed back to back with their lengths, so a name containing
+	// a comma cannot split into two parameters
+	var names []byte
+	var lengths []C.size_t
+	for _, param := range params {
+		names = append(names, param...)
+		lengths = append(lengths, C.size_t(len(param)))
+	}
+	var lengthsPtr *C.size_t
+	if len(lengths) > 0 {
+		lengthsPtr = &lengths[0]
+	}
+
+	var cache *C.char
+	if len(config.cache) > 0 {
+		cache = (*C.char)(unsafe.Pointer(&config.cache[0]))
+	}
+	produceCache := C.int(0)
+	if config.produceCache {
+		produceCache = 1
+	}
+
+	rtn := C.CompileFunction(e.contextPtr, bytesPtr(names), lengthsPtr, C.size_t(len(lengths)), stringPtr(body), C.size_t(len(body)), stringPtr(origin), C.size_t(len(origin)), cache, C.size_t(len(config.cache)), produceCache)
+	if err := getRtnError(rtn.error); err != nil {
+		return nil, err
+	}
+
+	v := &Value{rtn.function, e}
+	runtime.SetFinalizer(v, (*Value).finalizer)
+	return &Function{
+		Value:         v,
+		cache:         getBytes(rtn.cache),
+		cacheRejected: rtn.cache_rejected != 0,
+	}, nil
+}
+
+// CodeCache returns the code cache produced for the function with
+// WithProduceFunctionCache, or nil
+func (f *Function) CodeCache() []byte {
+	return f.cache
+}
+
+// CacheRejected reports whether V8 rejected the cache passed with
+// WithFunctionCache, for example because it was produced by another V8
+// version, and compiled the function from source instead
+func (f *Function) CacheRejected() bool {
+	return f.cacheRejected
+}
+
+// Call calls the function with args and returns its result. Arguments may be
+// nil (null), booleans, integers, floats, strings, or Values and Functions of
+// the same engine. Exceptions are returned as a *JSError.
+func (f *Function) Call(args ...interface{}) (*Value, error) {
+	values, strs, err := hostValues(f.engine, args)
+	if err != nil {
+		return nil, err
+	}
+
+	var valuesPtr *C.HostValue
+	if len(values) > 0 {
+		valuesPtr = &values[0]
+	}
+
+	rtn := C.CallFunction(f.ptr, valuesPtr, C.size_t(len(values)), bytesPtr(strs), C.size_t(len(strs)))
+	runtime.KeepAlive(args)
+	return f.engine.getValue(rtn), getError(rtn)
+}
+
+// hostValues converts args to HostValues. Strings are copied into a single
+// buffer, so they cross into C in one piece.
+func hostValues(e *Engine, args []interface{}) ([]C.HostValue, []byte, error) {
+	values := make([]C.HostValue, len(args))
+	var strs []byte
+	for i, arg := range args {
+		v := &values[i]
+		switch a := arg.(type) {
+		case nil:
+			v.kind = C.kHostNull
+		case bool:
+			v.kind = C.kHostBoolean
+			if a {
+				v.number = 1
+			}
+		case int:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case int8:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case int16:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case int32:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case int64:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case uint:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case uint8:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case uint16:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case uint32:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case uint64:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case float32:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case float64:
+			v.kind, v.number = C.kHostNumber, C.double(a)
+		case string:
+			v.kind = C.kHostString
+			v.offset, v.length = C.size_t(len(strs)), C.size_t(len(a))
+			strs = append(strs, a...)
+		case *Value:
+			if a.engine != e {
+				return nil, nil, fmt.Errorf("v8engine: argument %d belongs to another engine", i)
+			}
+			v.kind, v.value = C.kHostValue, a.ptr
+		case *Function:
+			if a.engine != e {
+				return nil, nil, fmt.Errorf("v8engine: argument %d belongs to another engine", i)
+			}
+			v.kind, v.value = C.kHostValue, a.ptr
+		default:
+			return nil, nil, fmt.Errorf("v8engine: unsupported argument type %T", arg)
+		}
+	}
+	return values, strs, nil
+}
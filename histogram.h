@@ -0,0 +1,102 @@
+#ifndef V8ENGINE_HISTOGRAM_H
+#define V8ENGINE_HISTOGRAM_H
+
+#include "v8engine.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+// Lock-free log-linear histogram in the style of HDR histograms: values are
+// bucketed by their highest set bit with 8 linear sub-buckets each, giving a
+// relative error below 12.5%. Recording is a handful of relaxed atomic
+// operations, so it can be done on hot paths and read from any thread.
+class Histogram {
+ public:
+  Histogram() : count_(0), total_(0), max_(0) {
+    for (int i = 0; i < kBuckets; i++) {
+      buckets_[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  void Record(uint64_t value) {
+    buckets_[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(value, std::memory_order_relaxed);
+
+    uint64_t max = max_.load(std::memory_order_relaxed);
+    while (value > max && !max_.compare_exchange_weak(
+                              max, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  HistogramSnapshot Snapshot() const {
+    HistogramSnapshot snapshot;
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.total = total_.load(std::memory_order_relaxed);
+    snapshot.max = max_.load(std::memory_order_relaxed);
+    snapshot.p50 = Percentile(0.50, snapshot.count, snapshot.max);
+    snapshot.p90 = Percentile(0.90, snapshot.count, snapshot.max);
+    snapshot.p99 = Percentile(0.99, snapshot.count, snapshot.max);
+    return snapshot;
+  }
+
+ private:
+  static const int kSubBits = 3;
+  static const int kSubBuckets = 1 << kSubBits;
+  static const int kBuckets = (64 - kSubBits + 1) * kSubBuckets;
+
+  static int Bucket(uint64_t value) {
+    if (value < kSubBuckets) {
+      return static_cast<int>(value);
+    }
+    int msb = 63 - __builtin_clzll(value);
+    int sub = static_cast<int>(value >> (msb - kSubBits)) & (kSubBuckets - 1);
+    return (msb - kSubBits + 1) * kSubBuckets + sub;
+  }
+
+  // Largest value that falls into bucket i
+  static uint64_t BucketLimit(int i) {
+    if (i < kSubBuckets) {
+      return i;
+    }
+    int msb = i / kSubBuckets + kSubBits - 1;
+    uint64_t sub = i % kSubBuckets;
+    uint64_t width = uint64_t(1) << (msb - kSubBits);
+    return ((kSubBuckets + sub) << (msb - kSubBits)) + width - 1;
+  }
+
+  uint64_t Percentile(double p, uint64_t count, uint64_t max) const {
+    if (count == 0) {
+      return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(p * count);
+    if (rank >= count) {
+      rank = count - 1;
+    }
+
+    uint64_t seen = 0;
+    for (int i = 0; i < kBuckets; i++) {
+      seen += buckets_[i].load(std::memory_order_relaxed);
+      if (seen > rank) {
+        uint64_t limit = BucketLimit(i);
+        return limit < max ? limit : max;
+      }
+    }
+    return max;
+  }
+
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> total_;
+  std::atomic<uint64_t> max_;
+  std::atomic<uint64_t> buckets_[kBuckets];
+};
+
+inline uint64_t MonotonicNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+#endif
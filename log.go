@@ -0,0 +1,187 @@
+package v8engine
+
+// #include "v8engine.h"
+import "C"
+
+import (
+	"encoding/binary"
+	"io"
+	"os"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+// LogPolicy decides what happens to print and log output that does not fit
+// into an engine's log buffer
+type LogPolicy int
+
+// Log buffer policies
+const (
+	// LogDrop drops lines that do not fit, see Engine.DroppedLogLines
+	LogDrop LogPolicy = C.kLogDrop
+	// LogBlock makes the script wait until the drainer has made room
+	LogBlock LogPolicy = C.kLogBlock
+)
+
+// DefaultLogBufferSize is the log buffer size used by WithLogOutput when
+// WithLogBuffer is not given
+const DefaultLogBufferSize = 64 * 1024
+
+// minLogBufferSize is the smallest log buffer WithLogBuffer creates, room for
+// a record header and a short line
+const minLogBufferSize = 64
+
+// logDrainInterval is how often buffered output is written out
+const logDrainInterval = 10 * time.Millisecond
+
+// WithLogBuffer makes V8Engine.print and V8Engine.log write into a buffer of
+// the given size instead of stdout and stderr. A background drainer writes
+// the buffered lines out in batches, so scripts never block on a write
+// syscall; with LogDrop they never block at all. Sizes below 64 bytes are
+// rounded up.
+func WithLogBuffer(bytes int, policy LogPolicy) Option {
+	if bytes < minLogBufferSize {
+		bytes = minLogBufferSize
+	}
+	return func(c *engineConfig) {
+		c.logBufferSize = bytes
+		c.logPolicy = policy
+	}
+}
+
+// WithLogOutput sends V8Engine.print output to stdout and V8Engine.log output
+// to stderr through a log buffer, see WithLogBuffer
+func WithLogOutput(stdout, stderr io.Writer) Option {
+	return func(c *engineConfig) {
+		c.logStdout = stdout
+		c.logStderr = stderr
+	}
+}
+
+// logSink drains the log buffer of one engine. It does not reference the
+// Engine, so registered engines can still be finalized.
+type logSink struct {
+	lock       sync.Mutex
+	contextPtr C.ContextPtr
+	stdout     io.Writer
+	stderr     io.Writer
+	buf        []byte
+}
+
+var (
+	logSinksLock sync.Mutex
+	logSinks     = make(map[*logSink]struct{})
+	logDrainer   sync.Once
+)
+
+func newLogSink(contextPtr C.ContextPtr, config *engineConfig) *logSink {
+	sink := &logSink{
+		contextPtr: contextPtr,
+		stdout:     config.logStdout,
+		stderr:     config.logStderr,
+		buf:        make([]byte, config.logBufferSize),
+	}
+	if sink.stdout == nil {
+		sink.stdout = os.Stdout
+	}
+	if sink.stderr == nil {
+		sink.stderr = os.Stderr
+	}
+
+	logSinksLock.Lock()
+	logSinks[sink] = struct{}{}
+	logSinksLock.Unlock()
+
+	logDrainer.Do(func() {
+		go drainLogs()
+	})
+	return sink
+}
+
+func drainLogs() {
+	var sinks []*logSink
+	for range time.Tick(logDrainInterval) {
+		sinks = sinks[:0]
+		logSinksLock.Lock()
+		for sink := range logSinks {
+			sinks = append(sinks, sink)
+		}
+		logSinksLock.Unlock()
+
+		for _, sink := range sinks {
+			sink.drain()
+		}
+	}
+}
+
+// drain writes out everything buffered so far. Consecutive lines of a stream
+// are written with a single Write. Write errors drop the batch.
+func (s *logSink) drain() {
+	s.lock.Lock()
+	defer s.lock.Unlock()
+
+	for s.contextPtr != nil {
+		n := int(C.DrainLog(s.contextPtr, (*C.char)(unsafe.Pointer(&s.buf[0])), C.size_t(len(s.buf))))
+		if n == 0 {
+			return
+		}
+
+		// Lines are compacted in place, each stream's batch ending where the
+		// next one starts
+		records := s.buf[:n]
+		batch := 0
+		out := 0
+		stream := byte(0)
+		for len(records) > 0 {
+			length := int(binary.LittleEndian.Uint32(records))
+			if records[4] != stream && out > batch {
+				s.write(stream, s.buf[batch:out])
+				batch = out
+			}
+			stream = records[4]
+			out += copy(s.buf[out:], records[5:5+length])
+			records = records[5+length:]
+		}
+		s.write(stream, s.buf[batch:out])
+	}
+}
+
+func (s *logSink) write(stream byte, p []byte) {
+	if len(p) == 0 {
+		return
+	}
+	if stream == C.kLogStderr {
+		s.stderr.Write(p)
+	} else {
+		s.stdout.Write(p)
+	}
+}
+
+// close writes out the remaining output and stops draining, before the
+// engine is disposed
+func (s *logSink) close() {
+	logSinksLock.Lock()
+	delete(logSinks, s)
+	logSinksLock.Unlock()
+
+	s.drain()
+
+	s.lock.Lock()
+	s.contextPtr = nil
+	s.lock.Unlock()
+}
+
+// FlushLog writes out the engine's buffered print and log output now, rather
+// than at the next drain
+func (e *Engine) FlushLog() {
+	if e.log != nil {
+		e.log.drain()
+	}
+}
+
+// DroppedLogLines returns the number of print and log lines dropped because
+// the log buffer was full
+func (e *Engine) DroppedLogLines() int {
+	return int(C.GetLogDropped(e.contextPtr))
+}
@@ -0,0 +1,122 @@
+#ifndef V8ENGINE_LOGBUFFER_H
+#define V8ENGINE_LOGBUFFER_H
+
+#include "v8engine.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+// Single-producer, single-consumer ring buffer of print and log lines. The
+// producer is whichever thread holds the isolate's Locker, the consumer the
+// drainer in Go, so writing a line is a couple of memcpys and atomic
+// operations, with no syscall and no lock.
+//
+// Records are stored as a 4-byte little-endian length, a stream byte
+// (kLogStdout or kLogStderr) and the line, and are drained in that form.
+class LogBuffer {
+ public:
+  static const size_t kHeaderSize = 5;
+
+  LogBuffer(size_t capacity, bool block)
+      : buffer_(capacity), block_(block), head_(0), tail_(0), dropped_(0) {}
+
+  // Appends a line. When the buffer is full the line is dropped, or, for a
+  // blocking buffer, the caller waits for the drainer to make room. Lines
+  // longer than the buffer are truncated, keeping their line break, and
+  // dropped when not even the header fits.
+  void Write(int stream, const char* data, size_t length) {
+    if (buffer_.size() < kHeaderSize) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    bool newline = false;
+    if (kHeaderSize + length > buffer_.size()) {
+      newline = length > 0 && data[length - 1] == '\n';
+      length = buffer_.size() - kHeaderSize;
+    }
+    uint64_t size = kHeaderSize + length;
+
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    while (buffer_.size() - (head - tail_.load(std::memory_order_acquire)) <
+           size) {
+      if (!block_) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return;
+      }
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+
+    char header[kHeaderSize];
+    uint32_t length32 = static_cast<uint32_t>(length);
+    for (int i = 0; i < 4; i++) {
+      header[i] = static_cast<char>(length32 >> (8 * i));
+    }
+    header[4] = static_cast<char>(stream);
+
+    Copy(head, header, kHeaderSize);
+    Copy(head + kHeaderSize, data, length);
+    if (newline && length > 0) {
+      // A truncated line still ends its line
+      Copy(head + kHeaderSize + length - 1, "\n", 1);
+    }
+    head_.store(head + size, std::memory_order_release);
+  }
+
+  // Moves as many whole records as fit into out and returns their size in
+  // bytes. An out buffer at least as large as the ring always fits a record.
+  size_t Drain(char* out, size_t length) {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    uint64_t tail = tail_.load(std::memory_order_relaxed);
+
+    size_t written = 0;
+    while (tail < head) {
+      unsigned char header[kHeaderSize];
+      Read(tail, reinterpret_cast<char*>(header), kHeaderSize);
+      uint64_t size = kHeaderSize + (header[0] | header[1] << 8 |
+                                     header[2] << 16 |
+                                     static_cast<uint32_t>(header[3]) << 24);
+      if (written + size > length) {
+        break;
+      }
+      Read(tail, out + written, size);
+      written += size;
+      tail += size;
+    }
+
+    tail_.store(tail, std::memory_order_release);
+    return written;
+  }
+
+  uint64_t Dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+ private:
+  void Copy(uint64_t position, const char* data, size_t length) {
+    size_t offset = position % buffer_.size();
+    size_t first = std::min(length, buffer_.size() - offset);
+    memcpy(&buffer_[offset], data, first);
+    memcpy(&buffer_[0], data + first, length - first);
+  }
+
+  void Read(uint64_t position, char* data, size_t length) const {
+    size_t offset = position % buffer_.size();
+    size_t first = std::min(length, buffer_.size() - offset);
+    memcpy(data, &buffer_[offset], first);
+    memcpy(data + first, &buffer_[0], length - first);
+  }
+
+  std::vector<char> buffer_;
+  bool block_;
+
+  // Total bytes ever written and drained; the difference is the fill level
+  std::atomic<uint64_t> head_;
+  std::atomic<uint64_t> tail_;
+
+  std::atomic<uint64_t> dropped_;
+};
+
+#endif
@@ -0,0 +1,126 @@
+package v8engine
+
+// #include <stdlib.h>
+// #include "v8engine.h"
+import "C"
+
+import (
+	"context"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+// Tick runs the platform tasks and timers that are due, along with the
+// microtasks they queue, without waiting. It returns how long until the next
+// timer is due and whether any timer is pending, so a host that drives its
+// own loop can schedule the next Tick. A timer callback that throws stops the
+// tick with its error; the remaining due timers run on the next one.
+func (e *Engine) Tick() (next time.Duration, pending bool, err error) {
+	if err := getRtnError(C.Tick(e.contextPtr)); err != nil {
+		return 0, true, err
+	}
+	ms := int64(C.NextTimer(e.contextPtr))
+	if ms < 0 {
+		return 0, false, nil
+	}
+	return time.Duration(ms) * time.Millisecond, true, nil
+}
+
+// RunLoop runs the engine's event loop on the calling goroutine until no
+// timers are pending, a timer callback throws or ctx is done. The engine is
+// unlocked while the loop waits for the next timer, so other goroutines can
+// call into it, and any timers they add are picked up.
+func (e *Engine) RunLoop(ctx context.Context) error {
+	var err error
+	e.untilDone(ctx, func(stop *C.int) {
+		err = getRtnError(C.RunLoop(e.contextPtr, stop))
+	})
+	if err != nil {
+		return err
+	}
+	return ctx.Err()
+}
+
+// RunAwait executes a script like Run. When its result is a promise, such as
+// the result of an async function, the event loop runs until the promise
+// settles, and its value is returned, or its rejection as a *JSError. Waiting
+// ends early with ctx's error once ctx is done; the script itself is not
+// interrupted.
+func (e *Engine) RunAwait(ctx context.Context, source string, origin string) (*Value, error) {
+	var rtn C.RtnValue
+	e.untilDone(ctx, func(stop *C.int) {
+		rtn = C.RunAwait(e.contextPtr, stringPtr(source), C.size_t(len(source)), stringPtr(origin), C.size_t(len(origin)), awaitTimeout(ctx), stop)
+	})
+	return e.getValue(rtn), awaitError(ctx, rtn)
+}
+
+// SendAwait passes msg to the callback registered with V8Engine.cb like Send,
+// and returns what the callback returns, awaiting it like RunAwait when it is
+// a promise
+func (e *Engine) SendAwait(ctx context.Context, msg []byte) (*Value, error) {
+	msgPointer := C.CBytes(msg)
+
+	var rtn C.RtnValue
+	e.untilDone(ctx, func(stop *C.int) {
+		rtn = C.SendAwait(e.contextPtr, C.size_t(len(msg)), msgPointer, awaitTimeout(ctx), stop)
+	})
+	return e.getValue(rtn), awaitError(ctx, rtn)
+}
+
+// untilDone calls fn with a stop flag for RunLoop and the await calls, which
+// is set with StopLoop once ctx is done
+func (e *Engine) untilDone(ctx context.Context, fn func(stop *C.int)) {
+	// The flag is written by StopLoop while the loop reads it, so it lives in
+	// C memory
+	stop := (*C.int)(C.calloc(1, C.size_t(unsafe.Sizeof(C.int(0)))))
+	defer C.free(unsafe.Pointer(stop))
+
+	done := make(chan struct{})
+	var wg sync.WaitGroup
+	wg.Add(1)
+	go func() {
+		defer wg.Done()
+		select {
+		case <-ctx.Done():
+			C.StopLoop(e.contextPtr, stop)
+		case <-done:
+		}
+	}()
+
+	fn(stop)
+	close(done)
+	wg.Wait()
+}
+
+// awaitTimeout returns the milliseconds until ctx's deadline, or -1 for no
+// deadline. The deadline is also enforced by untilDone; passing it along
+// saves a wakeup.
+func awaitTimeout(ctx context.Context) C.int64_t {
+	deadline, ok := ctx.Deadline()
+	if !ok {
+		return -1
+	}
+	timeout := time.Until(deadline)
+	if timeout < 0 {
+		return 0
+	}
+	return C.int64_t((timeout + time.Millisecond - 1) / time.Millisecond)
+}
+
+// awaitError reports waits that ended because ctx is done with ctx's error.
+// The deadline passed to C can expire just before ctx notices, as the event
+// loop clock has millisecond resolution.
+func awaitError(ctx context.Context, rtn C.RtnValue) error {
+	err := getError(rtn)
+	if err == nil || (rtn.error.kind != C.kErrorDeadline && rtn.error.kind != C.kErrorCanceled) {
+		return err
+	}
+	if ctx.Err() != nil {
+		return ctx.Err()
+	}
+	if rtn.error.kind == C.kErrorDeadline {
+		return context.DeadlineExceeded
+	}
+	return err
+}
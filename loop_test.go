@@ -0,0 +1,92 @@
+package v8engine
+
+import (
+	"context"
+	"strings"
+	"testing"
+	"time"
+)
+
+func TestTimers(t *testing.T) {
+	e := NewEngine()
+	if _, err := e.Run(`
+		var order = [];
+		setTimeout((a, b) => order.push("t30" + a + b), 30, "x", "y");
+		setTimeout(() => order.push("t10"), 10);
+		clearTimeout(setTimeout(() => order.push("cleared"), 5));
+		var k = 0;
+		var iv = setInterval(() => {
+			order.push("i" + k);
+			if (++k == 3) clearInterval(iv);
+		}, 7);
+		setTimeout(() => Promise.resolve().then(() => order.push("micro")), 0);
+	`, "timers.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	if err := e.RunLoop(context.Background()); err != nil {
+		t.Fatal(err)
+	}
+	v, _ := e.Run("order.join()", "timers.js")
+	if v.String() != "micro,i0,t10,i1,i2,t30xy" {
+		t.Fatalf("timers ran as %s", v)
+	}
+}
+
+func TestClearTimerDueInSameTick(t *testing.T) {
+	e := NewEngine()
+	// Both timers are due in the same tick; the first one cancels the second
+	if _, err := e.Run(`
+		var ran = [];
+		var second;
+		setTimeout(() => { ran.push("first"); clearTimeout(second); }, 5);
+		second = setTimeout(() => ran.push("second"), 5);
+	`, "clear.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	time.Sleep(20 * time.Millisecond)
+	if err := e.RunLoop(context.Background()); err != nil {
+		t.Fatal(err)
+	}
+	if v, _ := e.Run("ran.join()", "clear.js"); v.String() != "first" {
+		t.Fatalf("timers ran as %s", v)
+	}
+}
+
+func TestRunLoopCanceled(t *testing.T) {
+	e := NewEngine()
+	if _, err := e.Run("setInterval(() => {}, 5)", "loop.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	ctx, cancel := context.WithTimeout(context.Background(), 30*time.Millisecond)
+	defer cancel()
+	if err := e.RunLoop(ctx); err != context.DeadlineExceeded {
+		t.Fatalf("got %v, want context.DeadlineExceeded", err)
+	}
+}
+
+func TestTick(t *testing.T) {
+	e := NewEngine()
+	if _, err := e.Run(`
+		setTimeout(() => { throw new Error("boom") }, 1);
+		setTimeout(() => {}, 1000);
+	`, "tick.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	next, pending, err := e.Tick()
+	if err != nil || !pending || next <= 0 || next > time.Second {
+		t.Fatalf("got %v, %v, %v before any timer is due", next, pending, err)
+	}
+
+	time.Sleep(5 * time.Millisecond)
+	if _, pending, err = e.Tick(); err == nil || !strings.Contains(err.Error(), "boom") || !pending {
+		t.Fatalf("got %v, %v, want the timer's error with a timer pending", pending, err)
+	}
+
+	if _, err := e.Run("setTimeout(1)", "tick.js"); err == nil {
+		t.Fatal("setTimeout accepted a non-function")
+	}
+}
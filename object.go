@@ -0,0 +1,125 @@
+package v8engine
+
+// #include <stdlib.h>
+// #include "v8engine.h"
+import "C"
+
+import (
+	"fmt"
+	"runtime"
+	"unsafe"
+)
+
+// Key is a property name interned in an engine with InternKey. It is only
+// valid for that engine.
+type Key int
+
+// InternKey interns a property name in the engine and returns its handle.
+// Interning the same name again returns the same handle.
+func (e *Engine) InternKey(name string) Key {
+	return Key(C.InternKey(e.contextPtr, stringPtr(name), C.size_t(len(name))))
+}
+
+// NewObject returns a new empty object
+func (e *Engine) NewObject() *Value {
+	v := &Value{C.NewObject(e.contextPtr), e}
+	runtime.SetFinalizer(v, (*Value).finalizer)
+	return v
+}
+
+// GetMany reads the properties keys of an object in one call. Numbers are
+// returned as float64, booleans as bool, strings as string, null and
+// undefined as nil, and anything else as a *Value.
+func (v *Value) GetMany(keys ...Key) ([]interface{}, error) {
+	if len(keys) == 0 {
+		return nil, nil
+	}
+
+	cKeys := getKeys(keys)
+	values := make([]C.HostValue, len(keys))
+	rtn := C.GetMany(v.ptr, &cKeys[0], C.size_t(len(keys)), &values[0])
+	if err := getRtnError(rtn.error); err != nil {
+		return nil, err
+	}
+
+	var strs string
+	if rtn.strings.data != nil {
+		strs = C.GoStringN(rtn.strings.data, C.int(rtn.strings.length))
+		C.free(unsafe.Pointer(rtn.strings.data))
+	}
+
+	result := make([]interface{}, len(values))
+	for i, value := range values {
+		switch value.kind {
+		case C.kHostBoolean:
+			result[i] = value.number != 0
+		case C.kHostNumber:
+			result[i] = float64(value.number)
+		case C.kHostString:
+			result[i] = strs[value.offset : value.offset+value.length]
+		case C.kHostValue:
+			result[i] = v.engine.getValue(C.RtnValue{value: value.value})
+		}
+	}
+	return result, nil
+}
+
+// SetMany sets the properties keys of an object to values in one call.
+// Values may be of the types accepted by Function.Call.
+func (v *Value) SetMany(keys []Key, values []interface{}) error {
+	if len(keys) != len(values) {
+		return fmt.Errorf("v8engine: %d keys but %d values", len(keys), len(values))
+	}
+	if len(keys) == 0 {
+		return nil
+	}
+
+	hostVals, strs, err := hostValues(v.engine, values)
+	if err != nil {
+		return err
+	}
+	cKeys := getKeys(keys)
+	rtn := C.SetMany(v.ptr, &cKeys[0], C.size_t(len(keys)), &hostVals[0], bytesPtr(strs), C.size_t(len(strs)))
+	runtime.KeepAlive(values)
+	return getRtnError(rtn)
+}
+
+// SetGlobals sets global variables in one call. Values may be of the types
+// accepted by Function.Call.
+func (e *Engine) SetGlobals(globals map[Key]interface{}) error {
+	if len(globals) == 0 {
+		return nil
+	}
+
+	keys := make([]Key, 0, len(globals))
+	values := make([]interface{}, 0, len(globals))
+	for key, value := range globals {
+		keys = append(keys, key)
+		values = append(values, value)
+	}
+
+	hostVals, strs, err := hostValues(e, values)
+	if err != nil {
+		return err
+	}
+	cKeys := getKeys(keys)
+	rtn := C.SetGlobals(e.contextPtr, &cKeys[0], C.size_t(len(keys)), &hostVals[0], bytesPtr(strs), C.size_t(len(strs)))
+	runtime.KeepAlive(values)
+	return getRtnError(rtn)
+}
+
+func getKeys(keys []Key) []C.int {
+	cKeys := make([]C.int, len(keys))
+	for i, key := range keys {
+		cKeys[i] = C.int(key)
+	}
+	return cKeys
+}
+
+// bytesPtr returns a pointer to the bytes of b, or nil if it is empty
+func bytesPtr(b []byte) *C.char {
+	if len(b) == 0 {
+		return nil
+	}
+	return (*C.char)(unsafe.Pointer(&b[0]))
+}
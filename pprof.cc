@@ -0,0 +1,186 @@
+#include "pprof.h"
+
+namespace {
+
+// Protobuf wire format
+
+const int kVarint = 0;
+const int kLengthDelimited = 2;
+
+void PutVarint(std::string* out, uint64_t value) {
+  while (value >= 0x80) {
+    out->push_back(static_cast<char>(value | 0x80));
+    value >>= 7;
+  }
+  out->push_back(static_cast<char>(value));
+}
+
+void PutTag(std::string* out, int field, int wire_type) {
+  PutVarint(out, (static_cast<uint64_t>(field) << 3) | wire_type);
+}
+
+void PutInt(std::string* out, int field, int64_t value) {
+  if (value == 0) {
+    return;
+  }
+  PutTag(out, field, kVarint);
+  PutVarint(out, static_cast<uint64_t>(value));
+}
+
+void PutBytes(std::string* out, int field, const std::string& bytes) {
+  PutTag(out, field, kLengthDelimited);
+  PutVarint(out, bytes.size());
+  out->append(bytes);
+}
+
+template <typename T>
+void PutPacked(std::string* out, int field, const std::vector<T>& values) {
+  std::string packed;
+  for (T value : values) {
+    PutVarint(&packed, static_cast<uint64_t>(value));
+  }
+  PutBytes(out, field, packed);
+}
+
+// Field numbers from profile.proto
+
+enum ProfileField {
+  kProfileSampleType = 1,
+  kProfileSample = 2,
+  kProfileLocation = 4,
+  kProfileFunction = 5,
+  kProfileStringTable = 6,
+  kProfileTimeNanos = 9,
+  kProfileDurationNanos = 10,
+  kProfilePeriodType = 11,
+  kProfilePeriod = 12,
+};
+
+enum ValueTypeField { kValueTypeType = 1, kValueTypeUnit = 2 };
+enum SampleField { kSampleLocationId = 1, kSampleValue = 2 };
+enum LocationField { kLocationId = 1, kLocationLine = 4 };
+enum LineField { kLineFunctionId = 1, kLineLine = 2 };
+
+enum FunctionField {
+  kFunctionId = 1,
+  kFunctionName = 2,
+  kFunctionSystemName = 3,
+  kFunctionFilename = 4,
+  kFunctionStartLine = 5,
+};
+
+}  // namespace
+
+ProfileBuilder::ProfileBuilder() {
+  // The string table must start with the empty string
+  String("");
+}
+
+int64_t ProfileBuilder::String(const std::string& str) {
+  auto it = string_index_.find(str);
+  if (it != string_index_.end()) {
+    return it->second;
+  }
+
+  int64_t index = strings_.size();
+  strings_.push_back(str);
+  string_index_[str] = index;
+  return index;
+}
+
+void ProfileBuilder::AddSampleType(const std::string& type,
+                                   const std::string& unit) {
+  std::string value_type;
+  PutInt(&value_type, kValueTypeType, String(type));
+  PutInt(&value_type, kValueTypeUnit, String(unit));
+  PutBytes(&sample_types_, kProfileSampleType, value_type);
+}
+
+void ProfileBuilder::SetPeriod(const std::string& type,
+                               const std::string& unit,
+                               int64_t period) {
+  period_type_.clear();
+  PutInt(&period_type_, kValueTypeType, String(type));
+  PutInt(&period_type_, kValueTypeUnit, String(unit));
+  period_ = period;
+}
+
+void ProfileBuilder::SetTime(int64_t time_nanos, int64_t duration_nanos) {
+  time_nanos_ = time_nanos;
+  duration_nanos_ = duration_nanos;
+}
+
+uint64_t ProfileBuilder::Function(const std::string& name,
+                                  const std::string& filename,
+                                  int64_t start_line) {
+  auto key = std::make_tuple(String(name), String(filename), start_line);
+  auto it = functions_.find(key);
+  if (it != functions_.end()) {
+    return it->second;
+  }
+
+  uint64_t id = functions_.size() + 1;
+  functions_[key] = id;
+  return id;
+}
+
+uint64_t ProfileBuilder::Location(const std::string& function,
+                                  const std::string& filename,
+                                  int64_t start_line,
+                                  int64_t line) {
+  auto key = std::make_pair(Function(function, filename, start_line), line);
+  auto it = locations_.find(key);
+  if (it != locations_.end()) {
+    return it->second;
+  }
+
+  uint64_t id = locations_.size() + 1;
+  locations_[key] = id;
+  return id;
+}
+
+void ProfileBuilder::AddSample(const std::vector<uint64_t>& locations,
+                               const std::vector<int64_t>& values) {
+  std::string sample;
+  PutPacked(&sample, kSampleLocationId, locations);
+  PutPacked(&sample, kSampleValue, values);
+  PutBytes(&samples_, kProfileSample, sample);
+}
+
+std::string ProfileBuilder::Serialize() {
+  std::string out = sample_types_;
+  out.append(samples_);
+
+  for (auto& entry : locations_) {
+    std::string line;
+    PutInt(&line, kLineFunctionId, entry.first.first);
+    PutInt(&line, kLineLine, entry.first.second);
+
+    std::string location;
+    PutInt(&location, kLocationId, entry.second);
+    PutBytes(&location, kLocationLine, line);
+    PutBytes(&out, kProfileLocation, location);
+  }
+
+  for (auto& entry : functions_) {
+    std::string function;
+    PutInt(&function, kFunctionId, entry.second);
+    PutInt(&function, kFunctionName, std::get<0>(entry.first));
+    PutInt(&function, kFunctionSystemName, std::get<0>(entry.first));
+    PutInt(&function, kFunctionFilename, std::get<1>(entry.first));
+    PutInt(&function, kFunctionStartLine, std::get<2>(entry.first));
+    PutBytes(&out, kProfileFunction, function);
+  }
+
+  for (auto& str : strings_) {
+    PutBytes(&out, kProfileStringTable, str);
+  }
+
+  PutInt(&out, kProfileTimeNanos, time_nanos_);
+  PutInt(&out, kProfileDurationNanos, duration_nanos_);
+  if (!period_type_.empty()) {
+    PutBytes(&out, kProfilePeriodType, period_type_);
+  }
+  PutInt(&out, kProfilePeriod, period_);
+  return out;
+}
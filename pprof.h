@@ -0,0 +1,56 @@
+#ifndef V8ENGINE_PPROF_H
+#define V8ENGINE_PPROF_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+// Builds a profile in the pprof protobuf format (github.com/google/pprof,
+// proto/profile.proto), uncompressed. Functions and locations are
+// deduplicated; samples are encoded as they are added.
+class ProfileBuilder {
+ public:
+  ProfileBuilder();
+
+  void AddSampleType(const std::string& type, const std::string& unit);
+  void SetPeriod(const std::string& type,
+                 const std::string& unit,
+                 int64_t period);
+  void SetTime(int64_t time_nanos, int64_t duration_nanos);
+
+  // Returns the id of the location for a line of a function
+  uint64_t Location(const std::string& function,
+                    const std::string& filename,
+                    int64_t start_line,
+                    int64_t line);
+
+  // locations are ordered leaf first
+  void AddSample(const std::vector<uint64_t>& locations,
+                 const std::vector<int64_t>& values);
+
+  std::string Serialize();
+
+ private:
+  int64_t String(const std::string& str);
+  uint64_t Function(const std::string& name,
+                    const std::string& filename,
+                    int64_t start_line);
+
+  std::vector<std::string> strings_;
+  std::map<std::string, int64_t> string_index_;
+
+  std::map<std::tuple<int64_t, int64_t, int64_t>, uint64_t> functions_;
+  std::map<std::pair<uint64_t, int64_t>, uint64_t> locations_;
+
+  std::string sample_types_;
+  std::string samples_;
+  std::string period_type_;
+  int64_t period_ = 0;
+  int64_t time_nanos_ = 0;
+  int64_t duration_nanos_ = 0;
+};
+
+#endif
@@ -0,0 +1,222 @@
+package v8engine
+
+// #include "v8engine.h"
+import "C"
+
+import (
+	"bufio"
+	"fmt"
+	"os"
+	"strconv"
+	"strings"
+	"sync"
+	"sync/atomic"
+	"time"
+)
+
+// MemoryPressureLevel tells V8 how aggressively to reclaim memory
+type MemoryPressureLevel int
+
+// Memory pressure levels, matching v8::MemoryPressureLevel
+const (
+	MemoryPressureNone MemoryPressureLevel = iota
+	MemoryPressureModerate
+	MemoryPressureCritical
+)
+
+// MemoryPressure forwards host memory pressure to the engine. Moderate
+// pressure speeds up incremental GC, critical pressure triggers a full GC.
+// It can be called from any goroutine, even while the engine is running.
+func (e *Engine) MemoryPressure(level MemoryPressureLevel) {
+	C.MemoryPressure(e.contextPtr, C.int(level))
+}
+
+// SetIdle marks the engine as idle (or busy again), so V8 favors memory over
+// latency while it is not serving requests
+func (e *Engine) SetIdle(idle bool) {
+	if idle {
+		atomic.StoreInt32(&e.idle, 1)
+		C.SetIdle(e.contextPtr, 1)
+	} else {
+		atomic.StoreInt32(&e.idle, 0)
+		atomic.StoreInt32(&e.idleDone, 0)
+		C.SetIdle(e.contextPtr, 0)
+	}
+}
+
+// IdleGC gives the engine up to d of idle time for pending GC work. It
+// returns true when V8 reports there is nothing left worth doing.
+func (e *Engine) IdleGC(d time.Duration) bool {
+	done := C.IdleNotification(e.contextPtr, C.double(d.Seconds())) != 0
+	if done {
+		atomic.StoreInt32(&e.idleDone, 1)
+	}
+	return done
+}
+
+// PressureMonitor polls the kernel's memory pressure stall information (PSI)
+// and forwards it to a set of engines. On every poll it also gives engines
+// marked idle with SetIdle a slice of idle GC time, until they have nothing
+// left to collect.
+type PressureMonitor struct {
+	// Path of the PSI file. Defaults to the cgroup's memory.pressure when
+	// running under cgroup v2, and /proc/pressure/memory otherwise.
+	Path string
+
+	// Thresholds on the "some avg10" stall percentage at which moderate and
+	// critical pressure are signalled
+	Moderate float64
+	Critical float64
+
+	// Interval between polls
+	Interval time.Duration
+
+	// Idle GC time given to each idle engine per poll, 0 disables idle GC
+	IdleBudget time.Duration
+
+	mu      sync.Mutex
+	engines map[*Engine]struct{}
+	level   MemoryPressureLevel
+	stop    chan struct{}
+	done    chan struct{}
+}
+
+// NewPressureMonitor creates a monitor with default thresholds of 10% and 40%
+// stall time, polling every second
+func NewPressureMonitor() *PressureMonitor {
+	path := "/sys/fs/cgroup/memory.pressure"
+	if _, err := os.Stat(path); err != nil {
+		path = "/proc/pressure/memory"
+	}
+
+	return &PressureMonitor{
+		Path:       path,
+		Moderate:   10,
+		Critical:   40,
+		Interval:   time.Second,
+		IdleBudget: 10 * time.Millisecond,
+		engines:    make(map[*Engine]struct{}),
+	}
+}
+
+// Add registers an engine with the monitor. Registered engines are kept
+// alive until they are removed.
+func (m *PressureMonitor) Add(e *Engine) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	m.engines[e] = struct{}{}
+}
+
+// Remove unregisters an engine
+func (m *PressureMonitor) Remove(e *Engine) {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	delete(m.engines, e)
+}
+
+// Start begins polling in a background goroutine
+func (m *PressureMonitor) Start() error {
+	if _, err := readPressure(m.Path); err != nil {
+		return err
+	}
+
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	if m.stop != nil {
+		return fmt.Errorf("v8engine: pressure monitor already started")
+	}
+	m.stop = make(chan struct{})
+	m.done = make(chan struct{})
+	go m.run(m.stop, m.done)
+	return nil
+}
+
+// Stop ends polling and waits for the background goroutine to exit. It does
+// nothing if the monitor is not running.
+func (m *PressureMonitor) Stop() {
+	m.mu.Lock()
+	stop, done := m.stop, m.done
+	m.stop, m.done = nil, nil
+	m.mu.Unlock()
+
+	if stop == nil {
+		return
+	}
+	close(stop)
+	<-done
+}
+
+func (m *PressureMonitor) run(stop, done chan struct{}) {
+	defer close(done)
+
+	ticker := time.NewTicker(m.Interval)
+	defer ticker.Stop()
+
+	for {
+		select {
+		case <-stop:
+			return
+		case <-ticker.C:
+			m.poll()
+		}
+	}
+}
+
+func (m *PressureMonitor) poll() {
+	level := m.level
+	if avg10, err := readPressure(m.Path); err == nil {
+		switch {
+		case avg10 >= m.Critical:
+			level = MemoryPressureCritical
+		case avg10 >= m.Moderate:
+			level = MemoryPressureModerate
+		default:
+			level = MemoryPressureNone
+		}
+	}
+
+	m.mu.Lock()
+	engines := make([]*Engine, 0, len(m.engines))
+	for e := range m.engines {
+		engines = append(engines, e)
+	}
+	m.mu.Unlock()
+
+	changed := level != m.level
+	m.level = level
+
+	for _, e := range engines {
+		if changed {
+			e.MemoryPressure(level)
+		}
+		if m.IdleBudget > 0 && atomic.LoadInt32(&e.idle) == 1 && atomic.LoadInt32(&e.idleDone) == 0 {
+			e.IdleGC(m.IdleBudget)
+		}
+	}
+}
+
+// readPressure returns the "some avg10" value of a PSI file
+func readPressure(path string) (float64, error) {
+	f, err := os.Open(path)
+	if err != nil {
+		return 0, err
+	}
+	defer f.Close()
+
+	scanner := bufio.NewScanner(f)
+	for scanner.Scan() {
+		fields := strings.Fields(scanner.Text())
+		if len(fields) < 2 || fields[0] != "some" {
+			continue
+		}
+		for _, field := range fields[1:] {
+			if strings.HasPrefix(field, "avg10=") {
+				return strconv.ParseFloat(strings.TrimPrefix(field, "avg10="), 64)
+			}
+		}
+	}
+	if err := scanner.Err(); err != nil {
+		return 0, err
+	}
+	return 0, fmt.Errorf("%s: no \"some avg10\" entry", path)
+}
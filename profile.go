@@ -0,0 +1,130 @@
+package v8engine
+
+// #include "v8engine.h"
+import "C"
+
+import (
+	"compress/gzip"
+	"errors"
+	"io"
+	"sync"
+	"time"
+	"unsafe"
+)
+
+// StartCPUProfile starts sampling the JavaScript call stacks of the engine
+// every interval
+func (e *Engine) StartCPUProfile(interval time.Duration) error {
+	us := interval.Microseconds()
+	if us <= 0 {
+		us = 1
+	}
+
+	if C.StartCPUProfile(e.contextPtr, C.int(us)) != 0 {
+		return errors.New("v8engine: CPU profiling already enabled")
+	}
+	return nil
+}
+
+// StopCPUProfile stops the CPU profile started by StartCPUProfile and writes
+// it to w in the gzipped pprof format, for use with `go tool pprof`
+func (e *Engine) StopCPUProfile(w io.Writer) error {
+	profile := getBytes(C.StopCPUProfile(e.contextPtr))
+	if profile == nil {
+		return errors.New("v8engine: CPU profiling not enabled")
+	}
+	return writeProfile(w, profile)
+}
+
+// heapSamplingStackDepth is the maximum number of frames recorded for every
+// heap sample
+const heapSamplingStackDepth = 64
+
+// StartHeapSampling starts V8's sampling heap profiler, which records the
+// call stack of roughly one allocation every interval bytes. It is cheap
+// enough to leave enabled in production.
+func (e *Engine) StartHeapSampling(interval int) error {
+	if C.StartHeapSampling(e.contextPtr, C.uint64_t(interval), heapSamplingStackDepth) != 0 {
+		return errors.New("v8engine: heap sampling already enabled")
+	}
+	e.heapSamplingInterval = interval
+	return nil
+}
+
+// StopHeapSampling stops the sampling heap profiler and discards its samples
+func (e *Engine) StopHeapSampling() {
+	C.StopHeapSampling(e.contextPtr)
+}
+
+// GetAllocationProfile writes the samples collected since StartHeapSampling
+// to w in the gzipped pprof format. V8 drops the samples of objects once they
+// are garbage collected, so the profile shows the allocation sites of the
+// sampled objects that are still alive.
+func (e *Engine) GetAllocationProfile(w io.Writer) error {
+	profile := getBytes(C.GetAllocationProfile(e.contextPtr, C.uint64_t(e.heapSamplingInterval)))
+	if profile == nil {
+		return errors.New("v8engine: heap sampling not enabled")
+	}
+	return writeProfile(w, profile)
+}
+
+var (
+	snapshotTableLock sync.Mutex
+	nextSnapshotToken int
+	snapshotWriters   = make(map[int]*snapshotWriter)
+)
+
+type snapshotWriter struct {
+	w   io.Writer
+	err error
+}
+
+// WriteHeapSnapshot takes a heap snapshot and streams it to w in the Chrome
+// .heapsnapshot JSON format, chunk by chunk as it is serialized, so the
+// serialized snapshot is never held in memory as a whole. The engine is
+// locked until the snapshot is written.
+func (e *Engine) WriteHeapSnapshot(w io.Writer) error {
+	writer := &snapshotWriter{w: w}
+
+	snapshotTableLock.Lock()
+	nextSnapshotToken++
+	token := nextSnapshotToken
+	snapshotWriters[token] = writer
+	snapshotTableLock.Unlock()
+
+	C.WriteHeapSnapshot(e.contextPtr, C.int(token))
+
+	snapshotTableLock.Lock()
+	delete(snapshotWriters, token)
+	snapshotTableLock.Unlock()
+
+	return writer.err
+}
+
+// WriteHeapSnapshotChunk writes a chunk of a serialized heap snapshot
+//
+//export WriteHeapSnapshotChunk
+func WriteHeapSnapshotChunk(data *C.char, size C.int, writerToken C.int) C.int {
+	snapshotTableLock.Lock()
+	writer := snapshotWriters[int(writerToken)]
+	snapshotTableLock.Unlock()
+
+	if writer == nil {
+		return 1
+	}
+
+	chunk := unsafe.Slice((*byte)(unsafe.Pointer(data)), int(size))
+	if _, err := writer.w.Write(chunk); err != nil {
+		writer.err = err
+		return 1
+	}
+	return 0
+}
+
+func writeProfile(w io.Writer, profile []byte) error {
+	zw := gzip.NewWriter(w)
+	if _, err := zw.Write(profile); err != nil {
+		return err
+	}
+	return zw.Close()
+}
@@ -0,0 +1,130 @@
+package v8engine
+
+import (
+	"bytes"
+	"compress/gzip"
+	"errors"
+	"io"
+	"strings"
+	"testing"
+	"time"
+)
+
+// readProfile decompresses a pprof profile. Function and file names are
+// plain strings in its string table.
+func readProfile(t *testing.T, profile []byte) []byte {
+	t.Helper()
+	zr, err := gzip.NewReader(bytes.NewReader(profile))
+	if err != nil {
+		t.Fatal(err)
+	}
+	b, err := io.ReadAll(zr)
+	if err != nil {
+		t.Fatal(err)
+	}
+	return b
+}
+
+func TestCPUProfile(t *testing.T) {
+	e := NewEngine()
+	var buf bytes.Buffer
+	if err := e.StopCPUProfile(&buf); err == nil {
+		t.Fatal("StopCPUProfile succeeded without a profile")
+	}
+
+	if err := e.StartCPUProfile(100 * time.Microsecond); err != nil {
+		t.Fatal(err)
+	}
+	if err := e.StartCPUProfile(100 * time.Microsecond); err == nil {
+		t.Fatal("StartCPUProfile succeeded twice")
+	}
+	if _, err := e.Run(`function spin() {
+		let s = 0;
+		for (let i = 0; i < 2e7; i++) s += Math.sqrt(i);
+		return s;
+	}
+	spin();`, "cpu.js"); err != nil {
+		t.Fatal(err)
+	}
+	if err := e.StopCPUProfile(&buf); err != nil {
+		t.Fatal(err)
+	}
+
+	profile := readProfile(t, buf.Bytes())
+	if !bytes.Contains(profile, []byte("spin")) || !bytes.Contains(profile, []byte("cpu.js")) {
+		t.Fatal("the profile has no samples of spin in cpu.js")
+	}
+
+	// A stopped profiler can be started again
+	if err := e.StartCPUProfile(time.Millisecond); err != nil {
+		t.Fatal(err)
+	}
+	if err := e.StopCPUProfile(io.Discard); err != nil {
+		t.Fatal(err)
+	}
+}
+
+func TestHeapSampling(t *testing.T) {
+	e := NewEngine()
+	if err := e.GetAllocationProfile(io.Discard); err == nil {
+		t.Fatal("GetAllocationProfile succeeded without sampling")
+	}
+
+	if err := e.StartHeapSampling(1024); err != nil {
+		t.Fatal(err)
+	}
+	if err := e.StartHeapSampling(1024); err == nil {
+		t.Fatal("StartHeapSampling succeeded twice")
+	}
+	if _, err := e.Run(`var keep = [];
+	function allocate() {
+		for (let i = 0; i < 10000; i++) keep.push({i, s: "x" + i});
+	}
+	allocate();`, "heap.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	var buf bytes.Buffer
+	if err := e.GetAllocationProfile(&buf); err != nil {
+		t.Fatal(err)
+	}
+	if profile := readProfile(t, buf.Bytes()); !bytes.Contains(profile, []byte("allocate")) {
+		t.Fatal("the profile has no samples of allocate")
+	}
+
+	e.StopHeapSampling()
+	if err := e.GetAllocationProfile(io.Discard); err == nil {
+		t.Fatal("GetAllocationProfile succeeded after StopHeapSampling")
+	}
+}
+
+type failingWriter struct{}
+
+var errWriteFailed = errors.New("write failed")
+
+func (failingWriter) Write(p []byte) (int, error) {
+	return 0, errWriteFailed
+}
+
+func TestWriteHeapSnapshot(t *testing.T) {
+	e := NewEngine()
+	if _, err := e.Run("var marker = {markerProperty: 1};", "snapshot.js"); err != nil {
+		t.Fatal(err)
+	}
+
+	var buf strings.Builder
+	if err := e.WriteHeapSnapshot(&buf); err != nil {
+		t.Fatal(err)
+	}
+	snapshot := buf.String()
+	if !strings.HasPrefix(snapshot, `{"snapshot"`) || !strings.HasSuffix(snapshot, "}") {
+		t.Fatal("the snapshot is not a JSON object")
+	}
+	if !strings.Contains(snapshot, "markerProperty") {
+		t.Fatal("the snapshot misses a live object")
+	}
+
+	if err := e.WriteHeapSnapshot(failingWriter{}); !errors.Is(err, errWriteFailed) {
+		t.Fatalf("got %v, want the writer's error", err)
+	}
+}
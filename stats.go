@@ -0,0 +1,209 @@
+package v8engine
+
+// #include "v8engine.h"
+import "C"
+
+import (
+	"time"
+)
+
+// Histogram summarizes a distribution of durations
+type Histogram struct {
+	Count int64
+	Total time.Duration
+	Max   time.Duration
+	P50   time.Duration
+	P90   time.Duration
+	P99   time.Duration
+}
+
+func getHistogram(snapshot C.HistogramSnapshot) Histogram {
+	return Histogram{
+		Count: int64(snapshot.count),
+		Total: time.Duration(snapshot.total),
+		Max:   time.Duration(snapshot.max),
+		P50:   time.Duration(snapshot.p50),
+		P90:   time.Duration(snapshot.p90),
+		P99:   time.Duration(snapshot.p99),
+	}
+}
+
+// HeapStats describes the V8 heap of an engine
+type HeapStats struct {
+	TotalHeapSize           int
+	TotalHeapSizeExecutable int
+	TotalPhysicalSize       int
+	TotalAvailableSize      int
+	UsedHeapSize            int
+	HeapSizeLimit           int
+	MallocedMemory          int
+	PeakMallocedMemory      int
+	ExternalMemory          int
+	NativeContexts          int
+	DetachedContexts        int
+
+	Spaces []HeapSpaceStats
+}
+
+// HeapSpaceStats describes one space of the V8 heap
+type HeapSpaceStats struct {
+	Name          string
+	Size          int
+	UsedSize      int
+	AvailableSize int
+	PhysicalSize  int
+}
+
+// HeapStats returns the heap statistics of the engine, including every heap
+// space
+func (e *Engine) HeapStats() HeapStats {
+	hs := C.GetHeapStats(e.contextPtr)
+	stats := HeapStats{
+		TotalHeapSize:           int(hs.total_heap_size),
+		TotalHeapSizeExecutable: int(hs.total_heap_size_executable),
+		TotalPhysicalSize:       int(hs.total_physical_size),
+		TotalAvailableSize:      int(hs.total_available_size),
+		UsedHeapSize:            int(hs.used_heap_size),
+		HeapSizeLimit:           int(hs.heap_size_limit),
+		MallocedMemory:          int(hs.malloced_memory),
+		PeakMallocedMemory:      int(hs.peak_malloced_memory),
+		ExternalMemory:          int(hs.external_memory),
+		NativeContexts:          int(hs.number_of_native_contexts),
+		DetachedContexts:        int(hs.number_of_detached_contexts),
+	}
+
+	spaces := make([]C.HeapSpaceStats, 16)
+	n := int(C.GetHeapSpaceStats(e.contextPtr, &spaces[0], C.size_t(len(spaces))))
+	if n > len(spaces) {
+		spaces = make([]C.HeapSpaceStats, n)
+		n = int(C.GetHeapSpaceStats(e.contextPtr, &spaces[0], C.size_t(len(spaces))))
+	}
+
+	for _, space := range spaces[:n] {
+		stats.Spaces = append(stats.Spaces, HeapSpaceStats{
+			Name:          C.GoString(space.name),
+			Size:          int(space.space_size),
+			UsedSize:      int(space.space_used_size),
+			AvailableSize: int(space.space_available_size),
+			PhysicalSize:  int(space.physical_space_size),
+		})
+	}
+
+	return stats
+}
+
+// GCType identifies a kind of garbage collection
+type GCType int
+
+// Garbage collection types
+const (
+	GCScavenge             GCType = C.kGCTypeScavengeIndex
+	GCMarkSweepCompact     GCType = C.kGCTypeMarkSweepCompactIndex
+	GCIncrementalMarking   GCType = C.kGCTypeIncrementalMarkingIndex
+	GCProcessWeakCallbacks GCType = C.kGCTypeProcessWeakCallbacksIndex
+)
+
+func (t GCType) String() string {
+	switch t {
+	case GCScavenge:
+		return "scavenge"
+	case GCMarkSweepCompact:
+		return "mark-sweep-compact"
+	case GCIncrementalMarking:
+		return "incremental-marking"
+	case GCProcessWeakCallbacks:
+		return "process-weak-callbacks"
+	}
+	return "unknown"
+}
+
+// GCStats returns the distribution of GC pause times of the engine by GC type.
+// Reading them does not lock the engine.
+func (e *Engine) GCStats() map[GCType]Histogram {
+	stats := make(map[GCType]Histogram, C.kGCTypeCount)
+	for t := GCType(0); t < C.kGCTypeCount; t++ {
+		stats[t] = getHistogram(C.GetGCStats(e.contextPtr, C.int(t)))
+	}
+	return stats
+}
+
+// Call identifies an instrumented engine entry point
+type Call int
+
+// Instrumented calls. NewContext and DisposeContext are measured for the
+// whole process and reported by ProcessCallStats.
+const (
+	CallRun            Call = C.kCallRun
+	CallLoadModule     Call = C.kCallLoadModule
+	CallSend           Call = C.kCallSend
+	CallValueToString  Call = C.kCallValueToString
+	CallFunction       Call = C.kCallFunction
+	CallNewContext     Call = C.kCallNewContext
+	CallDisposeContext Call = C.kCallDisposeContext
+)
+
+func (c Call) String() string {
+	switch c {
+	case CallRun:
+		return "Run"
+	case CallLoadModule:
+		return "LoadModule"
+	case CallSend:
+		return "Send"
+	case CallValueToString:
+		return "ValueToString"
+	case CallFunction:
+		return "Function"
+	case CallNewContext:
+		return "NewContext"
+	case CallDisposeContext:
+		return "DisposeContext"
+	}
+	return "unknown"
+}
+
+// CallStats breaks down the latency of an entry point. Lock is the time spent
+// waiting for the engine's lock and Marshal the time spent converting
+// arguments, results and errors. A phase only counts the calls that reached
+// it, so failed calls may be missing from later phases.
+type CallStats struct {
+	Lock    Histogram
+	Compile Histogram
+	Execute Histogram
+	Marshal Histogram
+	Total   Histogram
+}
+
+func getCallStats(phase func(phase C.int) C.HistogramSnapshot) CallStats {
+	return CallStats{
+		Lock:    getHistogram(phase(C.kPhaseLock)),
+		Compile: getHistogram(phase(C.kPhaseCompile)),
+		Execute: getHistogram(phase(C.kPhaseExecute)),
+		Marshal: getHistogram(phase(C.kPhaseMarshal)),
+		Total:   getHistogram(phase(C.kPhaseTotal)),
+	}
+}
+
+// CallStats returns the latency of the engine's Run, LoadModule, Send,
+// Value.String and Function.Call calls by phase. Reading them does not lock the engine.
+func (e *Engine) CallStats() map[Call]CallStats {
+	stats := make(map[Call]CallStats, C.kCallNewContext)
+	for c := Call(0); c < C.kCallNewContext; c++ {
+		stats[c] = getCallStats(func(phase C.int) C.HistogramSnapshot {
+			return C.GetCallStats(e.contextPtr, C.int(c), phase)
+		})
+	}
+	return stats
+}
+
+// ProcessCallStats returns the latency of creating and disposing engines
+// across the process
+func ProcessCallStats() map[Call]CallStats {
+	stats := make(map[Call]CallStats, 2)
+	for _, c := range []Call{CallNewContext, CallDisposeContext} {
+		stats[c] = getCallStats(func(phase C.int) C.HistogramSnapshot {
+			return C.GetProcessCallStats(C.int(c), phase)
+		})
+	}
+	return stats
+}
@@ -0,0 +1,146 @@
+#ifndef V8ENGINE_TIMERWHEEL_H
+#define V8ENGINE_TIMERWHEEL_H
+
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel with a resolution of one tick (a millisecond for
+// the event loop). Level 0 has a slot per tick for the next 64 ticks, and
+// every level above covers 64 times the span of the one below. Entries move
+// down a level when their slot comes up, so adding a timer and expiring one
+// are O(1), however many timers are pending.
+//
+// Entries cannot be removed; the owner ignores expired ids it has cancelled.
+class TimerWheel {
+ public:
+  explicit TimerWheel(uint64_t now) : now_(now), count_(0) {
+    for (int level = 0; level < kLevels; level++) {
+      level_count_[level] = 0;
+    }
+  }
+
+  void Add(uint64_t id, uint64_t deadline) {
+    // The slot of the current tick has already expired
+    Place(Entry{id, deadline}, now_ + 1);
+    count_++;
+  }
+
+  // Moves the wheel forward to now and appends the ids of the expired
+  // entries to expired, in deadline order
+  void Advance(uint64_t now, std::vector<uint64_t>* expired) {
+    while (now_ < now) {
+      if (count_ == 0) {
+        now_ = now;
+        break;
+      }
+
+      // Skip the ticks on which nothing can expire or move down a level
+      int level = 0;
+      while (level_count_[level] == 0) {
+        level++;
+      }
+      if (level > 0) {
+        uint64_t skip_to = now_ | ((uint64_t(1) << (kBits * level)) - 1);
+        if (skip_to >= now) {
+          now_ = now;
+          break;
+        }
+        now_ = skip_to;
+      }
+
+      now_++;
+      for (level = 1; level < kLevels; level++) {
+        if ((now_ & ((uint64_t(1) << (kBits * level)) - 1)) != 0) {
+          break;
+        }
+        Cascade(level);
+      }
+
+      std::vector<Entry> due;
+      due.swap(slots_[0][now_ & kMask]);
+      level_count_[0] -= due.size();
+      for (const Entry& entry : due) {
+        if (entry.deadline > now_) {
+          Place(entry, now_);
+          continue;
+        }
+        expired->push_back(entry.id);
+        count_--;
+      }
+    }
+  }
+
+  // Ticks until the wheel next has to be advanced, or -1 when it is empty.
+  // Exact for entries due within 64 ticks; entries further out count from
+  // the tick they move down a level.
+  int64_t NextTick() const {
+    if (count_ == 0) {
+      return -1;
+    }
+
+    uint64_t next = UINT64_MAX;
+    if (level_count_[0] != 0) {
+      for (uint64_t tick = now_ + 1; tick <= now_ + kSlots; tick++) {
+        if (!slots_[0][tick & kMask].empty()) {
+          next = tick - now_;
+          break;
+        }
+      }
+    }
+
+    for (int level = 1; level < kLevels; level++) {
+      if (level_count_[level] != 0) {
+        uint64_t span = uint64_t(1) << (kBits * level);
+        uint64_t cascade = (now_ | (span - 1)) + 1 - now_;
+        if (cascade < next) {
+          next = cascade;
+        }
+        break;
+      }
+    }
+    return static_cast<int64_t>(next);
+  }
+
+  uint64_t Now() const { return now_; }
+
+ private:
+  static const int kBits = 6;
+  static const int kSlots = 1 << kBits;
+  static const uint64_t kMask = kSlots - 1;
+  static const int kLevels = 4;
+
+  struct Entry {
+    uint64_t id;
+    uint64_t deadline;
+  };
+
+  // Entries due before earliest are placed at earliest
+  void Place(const Entry& entry, uint64_t earliest) {
+    uint64_t deadline = entry.deadline > earliest ? entry.deadline : earliest;
+    uint64_t delta = deadline - now_;
+
+    int level = 0;
+    while (level < kLevels - 1 &&
+           delta >= (uint64_t(1) << (kBits * (level + 1)))) {
+      level++;
+    }
+    slots_[level][(deadline >> (kBits * level)) & kMask].push_back(entry);
+    level_count_[level]++;
+  }
+
+  void Cascade(int level) {
+    std::vector<Entry> entries;
+    entries.swap(slots_[level][(now_ >> (kBits * level)) & kMask]);
+    level_count_[level] -= entries.size();
+    for (const Entry& entry : entries) {
+      Place(entry, now_);
+    }
+  }
+
+  std::vector<Entry> slots_[kLevels][kSlots];
+  uint64_t now_;
+  size_t count_;
+  size_t level_count_[kLevels];
+};
+
+#endif
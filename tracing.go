@@ -0,0 +1,80 @@
+package v8engine
+
+// #include "v8engine.h"
+import "C"
+
+import (
+	"errors"
+	"io"
+	"strings"
+	"sync"
+	"unsafe"
+)
+
+// DefaultTraceCategories are recorded when EnableTracing is given no
+// categories: V8's own events plus the engine's Run, Send and LoadModule
+// spans. GC details are in "disabled-by-default-v8.gc".
+var DefaultTraceCategories = []string{"v8", "v8engine"}
+
+var (
+	traceLock   sync.Mutex
+	traceWriter io.Writer
+	traceErr    error
+)
+
+// EnableTracing starts recording Chrome trace events from all engines in the
+// process. Events are kept in a fixed-size ring buffer, so only the most
+// recent ones are written to w when DisableTracing is called. The output
+// opens in chrome://tracing and Perfetto.
+func EnableTracing(categories []string, w io.Writer) error {
+	v8init.Do(func() {
+		C.InitV8()
+	})
+
+	if len(categories) == 0 {
+		categories = DefaultTraceCategories
+	}
+	list := strings.Join(categories, ",")
+
+	traceLock.Lock()
+	defer traceLock.Unlock()
+
+	if C.EnableTracing(stringPtr(list), C.size_t(len(list))) != 0 {
+		return errors.New("v8engine: tracing is already enabled")
+	}
+	traceWriter = w
+	traceErr = nil
+	return nil
+}
+
+// DisableTracing stops recording and writes the trace to the writer given to
+// EnableTracing
+func DisableTracing() error {
+	traceLock.Lock()
+	defer traceLock.Unlock()
+
+	if traceWriter == nil {
+		return nil
+	}
+	C.DisableTracing()
+	err := traceErr
+	traceWriter = nil
+	traceErr = nil
+	return err
+}
+
+// WriteTraceChunk writes serialized trace events. It is only called from
+// DisableTracing, which holds traceLock.
+//
+//export WriteTraceChunk
+func WriteTraceChunk(data *C.char, size C.int) C.int {
+	if traceErr != nil {
+		return 1
+	}
+	chunk := unsafe.Slice((*byte)(unsafe.Pointer(data)), int(size))
+	if _, err := traceWriter.Write(chunk); err != nil {
+		traceErr = err
+		return 1
+	}
+	return 0
+}
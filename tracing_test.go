@@ -0,0 +1,68 @@
+package v8engine
+
+import (
+	"bytes"
+	"encoding/json"
+	"testing"
+)
+
+// traceEvents decodes the events of a Chrome trace with the given name
+func traceEvents(t *testing.T, trace []byte, name string) []map[string]interface{} {
+	t.Helper()
+	var doc struct {
+		TraceEvents []map[string]interface{} `json:"traceEvents"`
+	}
+	if err := json.Unmarshal(trace, &doc); err != nil {
+		t.Fatalf("invalid trace: %v", err)
+	}
+
+	var events []map[string]interface{}
+	for _, event := range doc.TraceEvents {
+		if event["name"] == name {
+			events = append(events, event)
+		}
+	}
+	return events
+}
+
+func TestTracing(t *testing.T) {
+	if err := DisableTracing(); err != nil {
+		t.Fatalf("DisableTracing without a session: %v", err)
+	}
+
+	var buf bytes.Buffer
+	if err := EnableTracing([]string{"v8engine"}, &buf); err != nil {
+		t.Fatal(err)
+	}
+	if err := EnableTracing(nil, &buf); err == nil {
+		DisableTracing()
+		t.Fatal("EnableTracing succeeded twice")
+	}
+
+	e := NewEngine()
+	for i := 0; i < 3; i++ {
+		if _, err := e.Run("1 + 1", "trace.js"); err != nil {
+			DisableTracing()
+			t.Fatal(err)
+		}
+	}
+	if err := DisableTracing(); err != nil {
+		t.Fatal(err)
+	}
+	if runs := traceEvents(t, buf.Bytes(), "Run"); len(runs) != 3 {
+		t.Fatalf("%d Run events, want 3", len(runs))
+	}
+
+	// A new session does not repeat the events of the previous one
+	buf.Reset()
+	if err := EnableTracing([]string{"v8engine"}, &buf); err != nil {
+		t.Fatal(err)
+	}
+	e.Run("1 + 1", "trace.js")
+	if err := DisableTracing(); err != nil {
+		t.Fatal(err)
+	}
+	if runs := traceEvents(t, buf.Bytes(), "Run"); len(runs) != 1 {
+		t.Fatalf("%d Run events in the second session, want 1", len(runs))
+	}
+}
@@ -1,32 +1,136 @@
 #include "v8engine.h"
 
+#include "allocator.h"
+#include "histogram.h"
+#include "logbuffer.h"
+#include "pprof.h"
+#include "timerwheel.h"
+#include "v8-profiler.h"
 #include "v8.h"
 
 #include "libplatform/libplatform.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cassert>
+#include <chrono>
 #include <cstdlib>
+#include <condition_variable>
 #include <cstring>
+#include <deque>
+#include <list>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <set>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include "_cgo_export.h"
 
 using namespace v8;
 
-auto defaultAllocator = ArrayBuffer::Allocator::NewDefaultAllocator();
-auto defaultPlatform = platform::NewDefaultPlatform();
+using platform::tracing::TraceBuffer;
+using platform::tracing::TraceConfig;
+using platform::tracing::TraceObject;
+using platform::tracing::TraceWriter;
+
+// Owned by defaultPlatform
+platform::tracing::TracingController* tracingController =
+    new platform::tracing::TracingController();
+
+// Idle task support lets idle engines be given time for GC work through
+// IdleNotification
+auto defaultPlatform = platform::NewDefaultPlatform(
+    0,
+    platform::IdleTaskSupport::kEnabled,
+    platform::InProcessStackDumping::kDisabled,
+    std::unique_ptr<v8::TracingController>(tracingController));
+
+typedef struct m_timer {
+  Global<Function> callback;
+  std::vector<Global<Value>> args;
+  uint64_t interval;  // milliseconds, 0 for a timeout
+} m_timer;
+
+typedef struct m_module {
+  Global<Module> ptr;
+  std::string name;
+  int hash;
+
+  // Approximate number of bytes kept alive by this module (source + name)
+  size_t bytes;
+
+  // Number of loaded modules that import this module. A module can only be
+  // unloaded or evicted once nothing depends on it anymore.
+  int refs;
+
+  // Specifier -> canonical name of each dependency, as returned by the
+  // resolver at load time
+  std::map<std::string, std::string> resolved;
+
+  std::list<m_module*>::iterator lru;
+} m_module;
 
 typedef struct {
   Persistent<Context> ptr;
   Isolate* isolate;
+  PooledAllocator* allocator;
+  std::unique_ptr<MicrotaskQueue> microtask_queue;  // nullptr for the isolate's
+  LogBuffer* log;  // nullptr when output is written directly
+
+  // Set by the near-heap-limit callback when execution is terminated because
+  // the isolate ran out of heap
+  std::atomic<bool> heap_limit_reached;
+
+  // GC pause times in nanoseconds by GC type
+  uint64_t gc_start[kGCTypeCount];
+  Histogram gc_pauses[kGCTypeCount];
+
+  // Durations of entry point calls in nanoseconds by call and phase. The
+  // per-engine calls come before kCallNewContext.
+  Histogram calls[kCallNewContext][kPhaseCount];
+
+  CpuProfiler* cpu_profiler;
+  int cpu_profile_interval;  // microseconds
+  int64_t cpu_profile_start;  // wall clock, nanoseconds since the epoch
 
   Persistent<Function> cb;
 
-  std::map<std::string, Eternal<Module>> modules;
-  std::map<int, std::map<std::string, Eternal<Module>>> resolved;
+  std::map<std::string, m_module*> modules;
+  std::map<int, m_module*> modules_by_hash;
+
+  // Modules of the load in progress. They are resolved ahead of the cache,
+  // and only join it once they evaluated.
+  std::map<std::string, m_module*> staged_modules;
+
+  // Most recently used module first
+  std::list<m_module*> module_lru;
+  size_t module_bytes;
+  size_t module_bytes_limit;  // 0 means unlimited
+  size_t modules_evicted;
+
+  // Property names interned with InternKey, indexed by handle
+  std::vector<Eternal<String>> keys;
+  std::map<std::string, int> key_handles;
+
+  // Event loop. Timer deadlines are in milliseconds since loop_epoch.
+  std::map<uint32_t, m_timer*> timers;
+  uint32_t next_timer_id;
+  std::unique_ptr<TimerWheel> timer_wheel;
+  uint64_t loop_epoch;
+  std::mutex loop_mutex;
+  std::condition_variable loop_cv;
+  bool loop_wakeup;  // a timer was added while the loop may be waiting
 } m_ctx;
 
 typedef struct {
@@ -51,32 +155,139 @@ const char* CopyString(String::Utf8Value& value) {
   return CopyString(*value);
 }
 
+// Sources
+
+// Sources at least this large are exposed to V8 as external strings when
+// their bytes can be kept alive outside the V8 heap
+const size_t kExternalSourceThreshold = 64 * 1024;
+
+// A one-byte source string that lives outside the V8 heap. The backing keeps
+// the underlying memory (a malloc'd buffer or a file mapping) alive until V8
+// disposes the string.
+class ExternalOneByteSource : public String::ExternalOneByteStringResource {
+ public:
+  ExternalOneByteSource(const char* data,
+                        size_t length,
+                        std::shared_ptr<void> backing)
+      : data_(data), length_(length), backing_(backing) {}
+
+  const char* data() const override { return data_; }
+  size_t length() const override { return length_; }
+
+ private:
+  const char* data_;
+  size_t length_;
+  std::shared_ptr<void> backing_;
+};
+
+bool IsOneByte(const char* data, size_t length) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  for (size_t i = 0; i < length; i++) {
+    if (p[i] & 0x80) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Creates a source string for data. Large pure ASCII sources are kept off the
+// V8 heap: in place when backing keeps their memory alive, otherwise from a
+// plain copy, which is cheaper than decoding them as UTF-8. Without backing,
+// data only has to stay valid for the duration of the call.
+MaybeLocal<String> NewSourceString(Isolate* isolate,
+                                   const char* data,
+                                   size_t length,
+                                   std::shared_ptr<void> backing) {
+  if (length >= kExternalSourceThreshold && IsOneByte(data, length)) {
+    if (!backing) {
+      char* copy = (char*)malloc(length);
+      memcpy(copy, data, length);
+      data = copy;
+      backing = std::shared_ptr<void>(copy, free);
+    }
+    return String::NewExternalOneByte(
+        isolate, new ExternalOneByteSource(data, length, backing));
+  }
+  return String::NewFromUtf8(isolate, data, NewStringType::kNormal, length);
+}
+
+// Maps a file read-only. The mapping is released when the last source string
+// created from it is disposed.
+std::shared_ptr<void> MapFile(const char* path, size_t* length) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) {
+    return nullptr;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    close(fd);
+    return nullptr;
+  }
+
+  *length = st.st_size;
+  if (*length == 0) {
+    close(fd);
+    return std::shared_ptr<void>(const_cast<char*>(""), [](void*) {});
+  }
+
+  void* addr = mmap(nullptr, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+
+  size_t mapped = *length;
+  return std::shared_ptr<void>(addr,
+                               [mapped](void* addr) { munmap(addr, mapped); });
+}
+
+RtnError FileError(const char* path) {
+  std::ostringstream sb;
+  sb << "Error: cannot map '" << path << "': " << strerror(errno);
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+  rtn.msg = CopyString(sb.str());
+  return rtn;
+}
+
 // Runtime
 
-void Fprint(FILE* out, const FunctionCallbackInfo<Value>& args) {
-  bool first = true;
+// Joins the arguments into one line, which goes to the log buffer when the
+// engine has one
+void Fprint(int stream, const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  HandleScope handle_scope(isolate);
+  m_ctx* ctx = static_cast<m_ctx*>(isolate->GetData(0));
+
+  std::string line;
   for (int i = 0; i < args.Length(); i++) {
-    Isolate* isolate = args.GetIsolate();
-    HandleScope handle_scope(isolate);
-    if (first) {
-      first = false;
-    } else {
-      fprintf(out, " ");
+    if (i > 0) {
+      line += ' ';
     }
     String::Utf8Value str(isolate, args[i]);
-    const char* cstr = CopyString(str);
-    fprintf(out, "%s", cstr);
+    if (*str != nullptr) {
+      line.append(*str, str.length());
+    }
+  }
+  line += '\n';
+
+  if (ctx->log != nullptr) {
+    ctx->log->Write(stream, line.data(), line.size());
+    return;
   }
-  fprintf(out, "\n");
+
+  FILE* out = stream == kLogStdout ? stdout : stderr;
+  fwrite(line.data(), 1, line.size(), out);
   fflush(out);
 }
 
 void Print(const FunctionCallbackInfo<Value>& args) {
-  Fprint(stdout, args);
+  Fprint(kLogStdout, args);
 }
 
 void Log(const FunctionCallbackInfo<Value>& args) {
-  Fprint(stderr, args);
+  Fprint(kLogStderr, args);
 }
 
 void cb(const FunctionCallbackInfo<Value>& args) {
@@ -94,36 +305,105 @@ void cb(const FunctionCallbackInfo<Value>& args) {
   ctx->cb.Reset(isolate, func);
 }
 
-// Errors
+// Timers
 
-RtnError ExceptionError(TryCatch& try_catch,
-                        Isolate* isolate,
-                        Local<Context> context) {
-  Locker locker(isolate);
-  Isolate::Scope isolate_scope(isolate);
+// Delays beyond a signed 32-bit millisecond count are treated as 1, like in
+// browsers and Node
+const double kMaxTimerDelay = 2147483647;
+
+uint64_t LoopNow(m_ctx* ctx) {
+  return (MonotonicNanos() - ctx->loop_epoch) / 1000000;
+}
+
+// Lets a waiting RunLoop pick up a new timer
+void WakeLoop(m_ctx* ctx) {
+  std::lock_guard<std::mutex> lock(ctx->loop_mutex);
+  ctx->loop_wakeup = true;
+  ctx->loop_cv.notify_all();
+}
+
+void AddTimer(const FunctionCallbackInfo<Value>& args, bool repeat) {
+  Isolate* isolate = args.GetIsolate();
+  m_ctx* ctx = static_cast<m_ctx*>(isolate->GetData(0));
   HandleScope handle_scope(isolate);
 
-  RtnError rtn = {nullptr, nullptr, nullptr};
+  if (args.Length() < 1 || !args[0]->IsFunction()) {
+    isolate->ThrowException(Exception::TypeError(
+        String::NewFromUtf8(isolate, "timer callback must be a function",
+                            NewStringType::kNormal)
+            .ToLocalChecked()));
+    return;
+  }
 
-  if (try_catch.HasTerminated()) {
-    rtn.msg =
-        CopyString("ExecutionTerminated: script execution has been terminated");
-    return rtn;
+  double delay = 1;
+  if (args.Length() > 1) {
+    delay = args[1]->NumberValue(isolate->GetCurrentContext()).FromMaybe(1);
+  }
+  if (!(delay >= 1 && delay <= kMaxTimerDelay)) {
+    delay = 1;
+  }
+
+  m_timer* timer = new m_timer;
+  timer->callback.Reset(isolate, args[0].As<Function>());
+  for (int i = 2; i < args.Length(); i++) {
+    timer->args.emplace_back(isolate, args[i]);
+  }
+  timer->interval = repeat ? static_cast<uint64_t>(delay) : 0;
+
+  uint32_t id = ++ctx->next_timer_id;
+  ctx->timers[id] = timer;
+  ctx->timer_wheel->Add(id, LoopNow(ctx) + static_cast<uint64_t>(delay));
+  WakeLoop(ctx);
+
+  args.GetReturnValue().Set(Integer::NewFromUnsigned(isolate, id));
+}
+
+void SetTimeout(const FunctionCallbackInfo<Value>& args) {
+  AddTimer(args, false);
+}
+
+void SetInterval(const FunctionCallbackInfo<Value>& args) {
+  AddTimer(args, true);
+}
+
+// Cancelled timers stay on the wheel and are skipped when they expire
+void ClearTimer(const FunctionCallbackInfo<Value>& args) {
+  Isolate* isolate = args.GetIsolate();
+  m_ctx* ctx = static_cast<m_ctx*>(isolate->GetData(0));
+  if (args.Length() < 1 || !args[0]->IsNumber()) {
+    return;
+  }
+
+  uint32_t id =
+      args[0]->Uint32Value(isolate->GetCurrentContext()).FromMaybe(0);
+  auto it = ctx->timers.find(id);
+  if (it != ctx->timers.end()) {
+    delete it->second;
+    ctx->timers.erase(it);
   }
+}
+
+// Errors
 
-  String::Utf8Value exception(isolate, try_catch.Exception());
-  rtn.msg = CopyString(exception);
+// Describes a thrown value or a promise rejection reason
+RtnError ValueError(Isolate* isolate,
+                    Local<Context> context,
+                    Local<Value> exception,
+                    Local<Message> msg) {
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+
+  String::Utf8Value message(isolate, exception);
+  rtn.msg = CopyString(message);
 
-  Local<Message> msg = try_catch.Message();
   if (!msg.IsEmpty()) {
     String::Utf8Value origin(isolate, msg->GetScriptOrigin().ResourceName());
     std::ostringstream sb;
     sb << *origin;
-    Maybe<int> line = try_catch.Message()->GetLineNumber(context);
+    Maybe<int> line = msg->GetLineNumber(context);
     if (line.IsJust()) {
       sb << ":" << line.ToChecked();
     }
-    Maybe<int> start = try_catch.Message()->GetStartColumn(context);
+    Maybe<int> start = msg->GetStartColumn(context);
     if (start.IsJust()) {
       sb << ":"
          << start.ToChecked() + 1;  // + 1 to match output from stack trace
@@ -131,27 +411,360 @@ RtnError ExceptionError(TryCatch& try_catch,
     rtn.location = CopyString(sb.str());
   }
 
-  MaybeLocal<Value> mstack = try_catch.StackTrace(context);
-  if (!mstack.IsEmpty()) {
-    String::Utf8Value stack(isolate, mstack.ToLocalChecked());
-    rtn.stack = CopyString(stack);
+  // The stack property of Error objects, as TryCatch::StackTrace reads it
+  if (exception->IsNativeError()) {
+    Local<Value> lStack;
+    Local<String> key =
+        String::NewFromUtf8(isolate, "stack", NewStringType::kInternalized)
+            .ToLocalChecked();
+    if (exception.As<Object>()->Get(context, key).ToLocal(&lStack)) {
+      String::Utf8Value stack(isolate, lStack);
+      rtn.stack = CopyString(stack);
+    }
   }
 
   return rtn;
 }
 
+RtnError ExceptionError(TryCatch& try_catch,
+                        Isolate* isolate,
+                        Local<Context> context) {
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+
+  if (try_catch.HasTerminated()) {
+    m_ctx* ctx = static_cast<m_ctx*>(isolate->GetData(0));
+    if (ctx->heap_limit_reached.exchange(false)) {
+      rtn.msg = CopyString(
+          "HeapLimitExceeded: script execution has been terminated because "
+          "the heap limit was reached");
+      rtn.kind = kErrorHeapLimit;
+      return rtn;
+    }
+    rtn.msg =
+        CopyString("ExecutionTerminated: script execution has been terminated");
+    rtn.kind = kErrorTerminated;
+    return rtn;
+  }
+
+  return ValueError(isolate, context, try_catch.Exception(),
+                    try_catch.Message());
+}
+
+// Tracing
+
+// Buffers serialized trace events and hands them to the Go writer of the
+// current tracing session
+class TraceOutput : public std::streambuf {
+ public:
+  TraceOutput() { setp(buffer_, buffer_ + sizeof(buffer_)); }
+
+ protected:
+  int overflow(int c) override {
+    if (sync() != 0) {
+      return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *pptr() = traits_type::to_char_type(c);
+      pbump(1);
+    }
+    return traits_type::not_eof(c);
+  }
+
+  int sync() override {
+    int length = pptr() - pbase();
+    setp(buffer_, buffer_ + sizeof(buffer_));
+    if (length > 0 && WriteTraceChunk(buffer_, length) != 0) {
+      return -1;
+    }
+    return 0;
+  }
+
+ private:
+  char buffer_[64 * 1024];
+};
+
+// Keeps the most recent trace events in a fixed number of chunks. Unlike
+// V8's ring buffer it starts out empty again after every flush, so a tracing
+// session never repeats events from an earlier one.
+class TraceRing : public TraceBuffer {
+ public:
+  explicit TraceRing(size_t max_chunks) : chunks_(max_chunks) {}
+
+  TraceObject* AddTraceEvent(uint64_t* handle) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count_ == 0 || chunks_[head_]->IsFull()) {
+      head_ = count_ == 0 ? 0 : (head_ + 1) % chunks_.size();
+      if (count_ < chunks_.size()) {
+        count_++;
+      }
+      if (chunks_[head_]) {
+        chunks_[head_]->Reset(seq_++);
+      } else {
+        chunks_[head_].reset(new platform::tracing::TraceBufferChunk(seq_++));
+      }
+    }
+
+    platform::tracing::TraceBufferChunk* chunk = chunks_[head_].get();
+    size_t event_index;
+    TraceObject* trace_object = chunk->AddTraceEvent(&event_index);
+    *handle = static_cast<uint64_t>(chunk->seq()) << 32 | head_ << 8 |
+              event_index;
+    return trace_object;
+  }
+
+  TraceObject* GetEventByHandle(uint64_t handle) override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t seq = handle >> 32;
+    size_t chunk_index = (handle >> 8) & 0xffffff;
+    size_t event_index = handle & 0xff;
+    if (chunk_index >= chunks_.size() || !chunks_[chunk_index]) {
+      return nullptr;
+    }
+    platform::tracing::TraceBufferChunk* chunk = chunks_[chunk_index].get();
+    if (chunk->seq() != seq || event_index >= chunk->size()) {
+      return nullptr;
+    }
+    return chunk->GetEventAt(event_index);
+  }
+
+  // Writes the buffered events, oldest first, to the session writer
+  bool Flush() override {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t oldest = (head_ + chunks_.size() + 1 - count_) % chunks_.size();
+    for (size_t i = 0; writer_ && i < count_; i++) {
+      platform::tracing::TraceBufferChunk* chunk =
+          chunks_[(oldest + i) % chunks_.size()].get();
+      for (size_t j = 0; j < chunk->size(); j++) {
+        writer_->AppendTraceEvent(chunk->GetEventAt(j));
+      }
+    }
+    if (writer_) {
+      writer_->Flush();
+    }
+    count_ = 0;
+    return true;
+  }
+
+  void SetWriter(TraceWriter* writer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    writer_.reset(writer);
+  }
+
+ private:
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<platform::tracing::TraceBufferChunk>> chunks_;
+  size_t head_ = 0;
+  size_t count_ = 0;
+  uint32_t seq_ = 1;  // Handles are never 0
+  std::unique_ptr<TraceWriter> writer_;
+};
+
+std::mutex tracingMutex;
+TraceRing* traceRing;  // Owned by tracingController
+TraceOutput traceOutput;
+std::ostream traceStream(&traceOutput);
+bool tracing = false;
+
+int EnableTracing(const char* categories, size_t length) {
+  std::lock_guard<std::mutex> lock(tracingMutex);
+  if (tracing) {
+    return 1;
+  }
+
+  TraceConfig* config = new TraceConfig();
+  config->SetTraceRecordMode(platform::tracing::RECORD_CONTINUOUSLY);
+  std::string list(categories, length);
+  size_t start = 0;
+  while (start <= list.size()) {
+    size_t end = list.find(',', start);
+    if (end == std::string::npos) {
+      end = list.size();
+    }
+    if (end > start) {
+      config->AddIncludedCategory(list.substr(start, end - start).c_str());
+    }
+    start = end + 1;
+  }
+
+  traceRing->SetWriter(TraceWriter::CreateJSONTraceWriter(traceStream));
+  tracingController->StartTracing(config);
+  tracing = true;
+  return 0;
+}
+
+// Writes the events left in the ring buffer and closes the JSON document
+void DisableTracing() {
+  std::lock_guard<std::mutex> lock(tracingMutex);
+  if (!tracing) {
+    return;
+  }
+
+  tracingController->StopTracing();
+  traceRing->SetWriter(nullptr);
+  traceStream.flush();
+  traceStream.clear();
+  tracing = false;
+}
+
+// Records a complete trace event in the v8engine category for the lifetime
+// of the span
+class TraceSpan {
+ public:
+  explicit TraceSpan(const char* name) : name_(name), handle_(0) {
+    static const uint8_t* category =
+        tracingController->GetCategoryGroupEnabled("v8engine");
+    category_ = category;
+    if (*category_) {
+      handle_ = tracingController->AddTraceEvent(
+          'X', category_, name_, nullptr, 0, 0, 0, nullptr, nullptr, nullptr,
+          nullptr, 0);
+    }
+  }
+
+  ~TraceSpan() {
+    if (handle_ != 0) {
+      tracingController->UpdateTraceEventDuration(category_, name_, handle_);
+    }
+  }
+
+ private:
+  const uint8_t* category_;
+  const char* name_;
+  uint64_t handle_;
+};
+
+// Call instrumentation
+
+// NewContext and DisposeContext durations, as there is no engine to hold them
+Histogram processCalls[kCallCount][kPhaseCount];
+
+// Records the phases of an entry point call. Each phase lasts from the end of
+// the previous one, and the total is recorded when the timer goes out of
+// scope.
+class CallTimer {
+ public:
+  explicit CallTimer(Histogram* phases)
+      : phases_(phases), start_(MonotonicNanos()), last_(start_) {}
+
+  ~CallTimer() { phases_[kPhaseTotal].Record(MonotonicNanos() - start_); }
+
+  void Phase(int phase) {
+    uint64_t now = MonotonicNanos();
+    phases_[phase].Record(now - last_);
+    last_ = now;
+  }
+
+ private:
+  Histogram* phases_;
+  uint64_t start_;
+  uint64_t last_;
+};
+
 // Initialize V8
 
 void InitV8() {
+  traceRing = new TraceRing(TraceBuffer::kRingBufferChunks);
+  tracingController->Initialize(traceRing);
   V8::InitializePlatform(defaultPlatform.get());
   V8::Initialize();
 }
 
 // Contexts
 
-ContextPtr NewContext() {
+int GCTypeIndex(GCType type) {
+  return __builtin_ctz(type);
+}
+
+void GCPrologue(Isolate* isolate, GCType type, GCCallbackFlags flags,
+                void* data) {
+  m_ctx* ctx = static_cast<m_ctx*>(data);
+  ctx->gc_start[GCTypeIndex(type)] = MonotonicNanos();
+}
+
+void GCEpilogue(Isolate* isolate, GCType type, GCCallbackFlags flags,
+                void* data) {
+  m_ctx* ctx = static_cast<m_ctx*>(data);
+  int index = GCTypeIndex(type);
+  ctx->gc_pauses[index].Record(MonotonicNanos() - ctx->gc_start[index]);
+}
+
+// Linux perf map shared by all isolates. Every entry is written with a
+// single write() to an O_APPEND descriptor, so concurrent isolates never
+// interleave lines and no lock is needed.
+std::once_flag perfMapOnce;
+int perfMapFd = -1;
+
+void OpenPerfMap() {
+  char path[64];
+  snprintf(path, sizeof(path), "/tmp/perf-%d.map", getpid());
+  perfMapFd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC,
+                   0644);
+}
+
+// Records JIT-compiled code so perf can symbolize JS frames. Bytecode is not
+// executed from its own address, so only machine code is listed. Moved code
+// is not tracked; perf keeps resolving the original address.
+void PerfMapCodeEvent(const JitCodeEvent* event) {
+  if (event->type != JitCodeEvent::CODE_ADDED ||
+      event->code_type != JitCodeEvent::JIT_CODE || perfMapFd < 0) {
+    return;
+  }
+
+  char line[512];
+  int length = snprintf(line, sizeof(line), "%lx %zx %.*s\n",
+                        reinterpret_cast<unsigned long>(event->code_start),
+                        event->code_len, static_cast<int>(event->name.len),
+                        event->name.str);
+  if (length <= 0) {
+    return;
+  }
+  if (length >= static_cast<int>(sizeof(line))) {
+    length = sizeof(line);
+    line[length - 1] = '\n';
+  }
+  ssize_t ignored = write(perfMapFd, line, length);
+  (void)ignored;
+}
+
+// Terminates the running script when the heap is about to run out, instead of
+// letting V8 abort the whole process. The limit is raised a little so the
+// script can unwind, and restored once the heap shrinks again.
+size_t NearHeapLimit(void* data,
+                     size_t current_heap_limit,
+                     size_t initial_heap_limit) {
+  m_ctx* ctx = static_cast<m_ctx*>(data);
+  ctx->heap_limit_reached = true;
+  ctx->isolate->TerminateExecution();
+  return current_heap_limit + current_heap_limit / 4;
+}
+
+ContextPtr NewContext(EngineConfig config) {
+  CallTimer timer(processCalls[kCallNewContext]);
+  PooledAllocator* allocator =
+      new PooledAllocator(config.array_buffer_limit, config.huge_pages != 0);
+
   Isolate::CreateParams params;
-  params.array_buffer_allocator = defaultAllocator;
+  params.array_buffer_allocator = allocator;
+  if (config.initial_old_generation_size != 0) {
+    params.constraints.set_initial_old_generation_size_in_bytes(
+        config.initial_old_generation_size);
+  }
+  if (config.max_old_generation_size != 0) {
+    params.constraints.set_max_old_generation_size_in_bytes(
+        config.max_old_generation_size);
+  }
+  if (config.initial_young_generation_size != 0) {
+    params.constraints.set_initial_young_generation_size_in_bytes(
+        config.initial_young_generation_size);
+  }
+  if (config.max_young_generation_size != 0) {
+    params.constraints.set_max_young_generation_size_in_bytes(
+        config.max_young_generation_size);
+  }
   Isolate* isolate = Isolate::New(params);
 
   Locker locker(isolate);
@@ -169,29 +782,95 @@ ContextPtr NewContext() {
   v8engine->Set(isolate, "log", FunctionTemplate::New(isolate, Log));
   v8engine->Set(isolate, "cb", FunctionTemplate::New(isolate, cb));
 
+  global->Set(isolate, "setTimeout",
+              FunctionTemplate::New(isolate, SetTimeout));
+  global->Set(isolate, "setInterval",
+              FunctionTemplate::New(isolate, SetInterval));
+  global->Set(isolate, "clearTimeout",
+              FunctionTemplate::New(isolate, ClearTimer));
+  global->Set(isolate, "clearInterval",
+              FunctionTemplate::New(isolate, ClearTimer));
+
+  MicrotasksPolicy microtask_policy = MicrotasksPolicy::kAuto;
+  if (config.microtask_policy == kMicrotasksExplicit) {
+    microtask_policy = MicrotasksPolicy::kExplicit;
+  } else if (config.microtask_policy == kMicrotasksScoped) {
+    microtask_policy = MicrotasksPolicy::kScoped;
+  }
+
   m_ctx* ctx = new m_ctx;
-  ctx->ptr.Reset(isolate, Context::New(isolate, NULL, global));
+  if (config.microtask_queue) {
+    // V8 only runs microtasks automatically for the isolate's queue. The
+    // entry points open a MicrotasksScope, so the scoped policy runs them at
+    // the same points.
+    if (microtask_policy == MicrotasksPolicy::kAuto) {
+      microtask_policy = MicrotasksPolicy::kScoped;
+    }
+    ctx->microtask_queue = MicrotaskQueue::New(isolate, microtask_policy);
+  } else {
+    isolate->SetMicrotasksPolicy(microtask_policy);
+  }
+  ctx->ptr.Reset(isolate,
+                 Context::New(isolate, nullptr, global, MaybeLocal<Value>(),
+                              DeserializeInternalFieldsCallback(),
+                              ctx->microtask_queue.get()));
   ctx->isolate = isolate;
+  ctx->allocator = allocator;
+  ctx->log = nullptr;
+  if (config.log_buffer_size != 0) {
+    ctx->log =
+        new LogBuffer(config.log_buffer_size, config.log_policy == kLogBlock);
+  }
+  ctx->heap_limit_reached = false;
+  ctx->cpu_profiler = nullptr;
+  ctx->module_bytes = 0;
+  ctx->module_bytes_limit = 0;
+  ctx->modules_evicted = 0;
+  ctx->next_timer_id = 0;
+  ctx->timer_wheel.reset(new TimerWheel(0));
+  ctx->loop_epoch = MonotonicNanos();
+  ctx->loop_wakeup = false;
   isolate->SetData(0, ctx);
+
+  isolate->AddNearHeapLimitCallback(NearHeapLimit, ctx);
+  isolate->AutomaticallyRestoreInitialHeapLimit();
+  isolate->AddGCPrologueCallback(GCPrologue, ctx);
+  isolate->AddGCEpilogueCallback(GCEpilogue, ctx);
+
+  if (config.perf_map) {
+    std::call_once(perfMapOnce, OpenPerfMap);
+    isolate->SetJitCodeEventHandler(kJitCodeEventEnumExisting,
+                                    PerfMapCodeEvent);
+  }
+
   return static_cast<ContextPtr>(ctx);
 }
 
-RtnValue Run(ContextPtr ptr, const char* source, const char* origin) {
-  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+RtnValue RunSource(m_ctx* ctx,
+                   const char* source,
+                   size_t length,
+                   std::shared_ptr<void> backing,
+                   const char* origin,
+                   size_t origin_length) {
+  TraceSpan span("Run");
+  CallTimer timer(ctx->calls[kCallRun]);
   Isolate* isolate = ctx->isolate;
   Locker locker(isolate);
+  timer.Phase(kPhaseLock);
   Isolate::Scope isolate_scope(isolate);
   HandleScope handle_scope(isolate);
   TryCatch try_catch(isolate);
 
   Local<Context> lContext = ctx->ptr.Get(isolate);
   Context::Scope context_scope(lContext);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
 
   Local<String> lSource =
-      String::NewFromUtf8(isolate, source, NewStringType::kNormal)
-          .ToLocalChecked();
+      NewSourceString(isolate, source, length, backing).ToLocalChecked();
   Local<String> lOrigin =
-      String::NewFromUtf8(isolate, source, NewStringType::kNormal)
+      String::NewFromUtf8(isolate, origin, NewStringType::kNormal,
+                          origin_length)
           .ToLocalChecked();
 
   RtnValue rtn = {nullptr, nullptr};
@@ -199,14 +878,18 @@ RtnValue Run(ContextPtr ptr, const char* source, const char* origin) {
   ScriptOrigin script_origin(lOrigin);
   MaybeLocal<Script> script =
       Script::Compile(lContext, lSource, &script_origin);
+  timer.Phase(kPhaseCompile);
   if (script.IsEmpty()) {
     rtn.error = ExceptionError(try_catch, isolate, lContext);
+    timer.Phase(kPhaseMarshal);
     return rtn;
   }
 
   MaybeLocal<v8::Value> result = script.ToLocalChecked()->Run(lContext);
+  timer.Phase(kPhaseExecute);
   if (result.IsEmpty()) {
     rtn.error = ExceptionError(try_catch, isolate, lContext);
+    timer.Phase(kPhaseMarshal);
     return rtn;
   }
   m_value* val = new m_value;
@@ -214,118 +897,2000 @@ RtnValue Run(ContextPtr ptr, const char* source, const char* origin) {
   val->ptr.Reset(isolate, Persistent<Value>(isolate, result.ToLocalChecked()));
 
   rtn.value = static_cast<ValuePtr>(val);
+  timer.Phase(kPhaseMarshal);
   return rtn;
 }
 
-MaybeLocal<Module> ResolveCallback(Local<Context> context,
-                                   Local<String> specifier,
-                                   Local<Module> referrer) {
-  Isolate* isolate = Isolate::GetCurrent();
-  m_ctx* ctx = (m_ctx*)isolate->GetData(0);
-
-  HandleScope handle_scope(isolate);
-
-  String::Utf8Value str(isolate, specifier);
-  const char* moduleName = *str;
-
-  if (ctx->resolved.count(referrer->GetIdentityHash()) == 0) {
-    return MaybeLocal<Module>();
-  }
-
-  std::map<std::string, Eternal<Module>> localResolve =
-      ctx->resolved[referrer->GetIdentityHash()];
-  if (localResolve.count(moduleName) == 0) {
-    return MaybeLocal<Module>();
-  }
-
-  return localResolve[moduleName].Get(isolate);
+RtnValue Run(ContextPtr ptr,
+             const char* source,
+             size_t source_length,
+             const char* origin,
+             size_t origin_length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return RunSource(ctx, source, source_length, nullptr, origin, origin_length);
 }
 
-int LoadModule(ContextPtr ptr,
-               char* source_s,
-               char* name_s,
-               int callback_index) {
+RtnValue RunFile(ContextPtr ptr, const char* path, const char* origin) {
   m_ctx* ctx = static_cast<m_ctx*>(ptr);
-  Isolate* isolate = ctx->isolate;
-  Locker locker(isolate);
-  Isolate::Scope isolate_scope(isolate);
-  HandleScope handle_scope(isolate);
-  TryCatch try_catch(isolate);
 
-  Local<Context> context = ctx->ptr.Get(isolate);
-  Context::Scope context_scope(context);
+  size_t length = 0;
+  std::shared_ptr<void> mapping = MapFile(path, &length);
+  if (!mapping) {
+    RtnValue rtn = {nullptr, nullptr};
+    rtn.error = FileError(path);
+    return rtn;
+  }
 
-  Local<String> name =
-      String::NewFromUtf8(isolate, name_s, NewStringType::kNormal)
-          .ToLocalChecked();
-  Local<String> source_text =
-      String::NewFromUtf8(isolate, source_s, NewStringType::kNormal)
-          .ToLocalChecked();
+  return RunSource(ctx, static_cast<const char*>(mapping.get()), length,
+                   mapping, origin, strlen(origin));
+}
 
-  Local<Integer> resource_line_offset = Integer::New(isolate, 0);
-  Local<Integer> resource_column_offset = Integer::New(isolate, 0);
-  Local<Boolean> resource_is_shared_cross_origin = True(isolate);
-  Local<Integer> script_id = Local<Integer>();
-  Local<Value> source_map_url = Local<Value>();
-  Local<Boolean> resource_is_opaque = False(isolate);
-  Local<Boolean> is_wasm = False(isolate);
-  Local<Boolean> is_module = True(isolate);
-  Local<PrimitiveArray> host_defined_options = Local<PrimitiveArray>();
+// Streaming
+
+// Feeds data pushed from Go to the V8 parser, which pulls it from a
+// background thread. The data is kept in one buffer that also backs the
+// source string of the final compile. V8 takes ownership of the chunks it
+// pulls, so each is copied out of the buffer as it is handed over.
+class ChunkedSourceStream : public ScriptCompiler::ExternalSourceStream {
+ public:
+  size_t GetMoreData(const uint8_t** src) override {
+    std::unique_lock<std::mutex> lock(mutex_);
+    available_.wait(lock,
+                    [this] { return read_ < source_->size() || ended_; });
+    size_t length = source_->size() - read_;
+    if (length == 0) {
+      return 0;
+    }
 
-  ScriptOrigin origin(name, resource_line_offset, resource_column_offset,
-                      resource_is_shared_cross_origin, script_id,
-                      source_map_url, resource_is_opaque, is_wasm, is_module,
-                      host_defined_options);
+    uint8_t* chunk = new uint8_t[length];
+    memcpy(chunk, source_->data() + read_, length);
+    read_ += length;
+    *src = chunk;
+    return length;
+  }
 
-  ScriptCompiler::Source source(source_text, origin);
-  Local<Module> module;
+  void Push(const char* data, size_t length) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    source_->insert(source_->end(), data, data + length);
+    available_.notify_one();
+  }
 
-  if (!ScriptCompiler::CompileModule(isolate, &source).ToLocal(&module)) {
-    assert(try_catch.HasCaught());
-    auto err = ExceptionError(try_catch, isolate, context);
-    printf("%s\n", err.msg);
-    return 1;
+  void End() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    ended_ = true;
+    available_.notify_one();
   }
 
-  std::map<std::string, Eternal<Module>> resolved;
+  // The pushed source, once the parser is done with it
+  std::shared_ptr<std::vector<char>> Source() { return source_; }
 
-  for (int i = 0; i < module->GetModuleRequestsLength(); i++) {
-    Local<String> dependency = module->GetModuleRequest(i);
-    String::Utf8Value str(isolate, dependency);
-    char* dependencySpecifier = *str;
+ private:
+  std::mutex mutex_;
+  std::condition_variable available_;
+  std::shared_ptr<std::vector<char>> source_ =
+      std::make_shared<std::vector<char>>();
+  size_t read_ = 0;
+  bool ended_ = false;
+};
 
-    auto retval = ResolveModule(dependencySpecifier, name_s, callback_index);
+typedef struct {
+  m_ctx* context;
+  std::string origin;
 
-    if (retval.r1 != 0) {
-      return retval.r1;
-    }
+  std::unique_ptr<ScriptCompiler::StreamedSource> source;
+  ChunkedSourceStream* stream;  // owned by source
 
-    if (ctx->modules.count(retval.r0) == 0) {
-      return 2;
-    }
+  std::mutex mutex;
+  std::condition_variable parsed_cv;
+  bool parsed;
+} m_stream;
 
-    resolved[dependencySpecifier] = ctx->modules[retval.r0];
-  }
+class StreamingTask : public Task {
+ public:
+  StreamingTask(ScriptCompiler::ScriptStreamingTask* task, m_stream* stream)
+      : task_(task), stream_(stream) {}
 
-  Eternal<Module> persistentModule(isolate, module);
-  ctx->modules[name_s] = persistentModule;
-  ctx->resolved[module->GetIdentityHash()] = resolved;
+  void Run() override {
+    task_->Run();
 
-  Maybe<bool> ok = module->InstantiateModule(context, ResolveCallback);
-  if (!ok.FromMaybe(false)) {
-    return 3;
+    std::lock_guard<std::mutex> lock(stream_->mutex);
+    stream_->parsed = true;
+    stream_->parsed_cv.notify_all();
   }
 
-  MaybeLocal<Value> result = module->Evaluate(context);
+ private:
+  std::unique_ptr<ScriptCompiler::ScriptStreamingTask> task_;
+  m_stream* stream_;
+};
 
-  if (result.IsEmpty()) {
-    assert(try_catch.HasCaught());
-    auto err = ExceptionError(try_catch, isolate, context);
-    printf("%s\n", err.msg);
-    return 4;
-  }
+void WaitForStream(m_stream* stream) {
+  stream->stream->End();
 
-  return 0;
+  std::unique_lock<std::mutex> lock(stream->mutex);
+  stream->parsed_cv.wait(lock, [stream] { return stream->parsed; });
+}
+
+StreamPtr StartStream(ContextPtr ptr, const char* origin, size_t origin_length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  m_stream* stream = new m_stream;
+  stream->context = ctx;
+  stream->origin.assign(origin, origin_length);
+  stream->stream = new ChunkedSourceStream();
+  stream->source.reset(new ScriptCompiler::StreamedSource(
+      std::unique_ptr<ScriptCompiler::ExternalSourceStream>(stream->stream),
+      ScriptCompiler::StreamedSource::UTF8));
+  stream->parsed = false;
+
+  ScriptCompiler::ScriptStreamingTask* task =
+      ScriptCompiler::StartStreamingScript(isolate, stream->source.get());
+  defaultPlatform->CallOnWorkerThread(
+      std::unique_ptr<Task>(new StreamingTask(task, stream)));
+
+  return static_cast<StreamPtr>(stream);
+}
+
+void StreamPush(StreamPtr ptr, const char* data, size_t length) {
+  m_stream* stream = static_cast<m_stream*>(ptr);
+  stream->stream->Push(data, length);
+}
+
+// Streamed scripts are recorded as Run calls. The compile phase includes
+// waiting for the background parse to finish.
+RtnValue FinishStream(StreamPtr ptr) {
+  m_stream* stream = static_cast<m_stream*>(ptr);
+  std::unique_ptr<m_stream> owned(stream);
+
+  m_ctx* ctx = stream->context;
+  TraceSpan span("RunStream");
+  CallTimer timer(ctx->calls[kCallRun]);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  timer.Phase(kPhaseLock);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> lContext = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(lContext);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  WaitForStream(stream);
+  std::shared_ptr<std::vector<char>> source = stream->stream->Source();
+  Local<String> lSource =
+      NewSourceString(isolate, source->data(), source->size(), source)
+          .ToLocalChecked();
+  Local<String> lOrigin =
+      String::NewFromUtf8(isolate, stream->origin.data(),
+                          NewStringType::kNormal, stream->origin.length())
+          .ToLocalChecked();
+
+  RtnValue rtn = {nullptr, nullptr};
+
+  ScriptOrigin script_origin(lOrigin);
+  MaybeLocal<Script> script = ScriptCompiler::Compile(
+      lContext, stream->source.get(), lSource, script_origin);
+  timer.Phase(kPhaseCompile);
+  if (script.IsEmpty()) {
+    rtn.error = ExceptionError(try_catch, isolate, lContext);
+    timer.Phase(kPhaseMarshal);
+    return rtn;
+  }
+
+  MaybeLocal<v8::Value> result = script.ToLocalChecked()->Run(lContext);
+  timer.Phase(kPhaseExecute);
+  if (result.IsEmpty()) {
+    rtn.error = ExceptionError(try_catch, isolate, lContext);
+    timer.Phase(kPhaseMarshal);
+    return rtn;
+  }
+  m_value* val = new m_value;
+  val->context = ctx;
+  val->ptr.Reset(isolate, Persistent<Value>(isolate, result.ToLocalChecked()));
+
+  rtn.value = static_cast<ValuePtr>(val);
+  timer.Phase(kPhaseMarshal);
+  return rtn;
+}
+
+void AbortStream(StreamPtr ptr) {
+  m_stream* stream = static_cast<m_stream*>(ptr);
+  WaitForStream(stream);
+  delete stream;
+}
+
+// Functions
+
+RtnFunction CompileFunction(ContextPtr ptr,
+                            const char* params,
+                            const size_t* param_lengths,
+                            size_t param_count,
+                            const char* body,
+                            size_t body_length,
+                            const char* origin,
+                            size_t origin_length,
+                            const char* cache_data,
+                            size_t cache_length,
+                            int produce_cache) {
+  TraceSpan span("CompileFunction");
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+
+  RtnFunction rtn = {};
+
+  std::vector<Local<String>> arguments;
+  for (size_t i = 0; i < param_count; i++) {
+    arguments.push_back(String::NewFromUtf8(isolate, params,
+                                            NewStringType::kInternalized,
+                                            param_lengths[i])
+                            .ToLocalChecked());
+    params += param_lengths[i];
+  }
+
+  Local<String> source_text =
+      String::NewFromUtf8(isolate, body, NewStringType::kNormal, body_length)
+          .ToLocalChecked();
+  Local<String> name =
+      String::NewFromUtf8(isolate, origin, NewStringType::kNormal,
+                          origin_length)
+          .ToLocalChecked();
+
+  // Owned by source
+  ScriptCompiler::CachedData* cache = nullptr;
+  ScriptCompiler::CompileOptions options = ScriptCompiler::kNoCompileOptions;
+  if (cache_length > 0) {
+    cache = new ScriptCompiler::CachedData(
+        reinterpret_cast<const uint8_t*>(cache_data), cache_length);
+    options = ScriptCompiler::kConsumeCodeCache;
+  }
+
+  ScriptOrigin script_origin(name);
+  ScriptCompiler::Source source(source_text, script_origin, cache);
+  Local<Function> function;
+  if (!ScriptCompiler::CompileFunctionInContext(context, &source,
+                                                arguments.size(),
+                                                arguments.data(), 0, nullptr,
+                                                options)
+           .ToLocal(&function)) {
+    // Parameter names that are not identifiers are rejected without an
+    // exception
+    if (!try_catch.HasCaught()) {
+      rtn.error.msg =
+          CopyString("SyntaxError: parameter names must be identifiers");
+      return rtn;
+    }
+    rtn.error = ExceptionError(try_catch, isolate, context);
+    return rtn;
+  }
+  rtn.cache_rejected = cache != nullptr && cache->rejected;
+
+  if (produce_cache) {
+    std::unique_ptr<ScriptCompiler::CachedData> code_cache(
+        ScriptCompiler::CreateCodeCacheForFunction(function));
+    if (code_cache) {
+      char* mem = (char*)malloc(code_cache->length);
+      memcpy(mem, code_cache->data, code_cache->length);
+      rtn.cache.data = mem;
+      rtn.cache.length = code_cache->length;
+    }
+  }
+
+  m_value* val = new m_value;
+  val->context = ctx;
+  val->ptr.Reset(isolate, function);
+  rtn.function = static_cast<ValuePtr>(val);
+  return rtn;
+}
+
+Local<Value> HostToValue(Isolate* isolate,
+                         const HostValue& arg,
+                         const char* strings) {
+  switch (arg.kind) {
+    case kHostNull:
+      return Null(isolate);
+    case kHostBoolean:
+      return Boolean::New(isolate, arg.number != 0);
+    case kHostNumber:
+      return Number::New(isolate, arg.number);
+    case kHostString:
+      return String::NewFromUtf8(isolate, strings + arg.offset,
+                                 NewStringType::kNormal, arg.length)
+          .ToLocalChecked();
+    case kHostValue:
+      return static_cast<m_value*>(arg.value)->ptr.Get(isolate);
+  }
+  return Undefined(isolate);
+}
+
+// Checks that the string values of a HostValue array lie within the strings
+// buffer they point into
+bool HostStringsInBounds(const HostValue* values,
+                         size_t count,
+                         size_t strings_length) {
+  for (size_t i = 0; i < count; i++) {
+    if (values[i].kind == kHostString &&
+        (values[i].offset > strings_length ||
+         values[i].length > strings_length - values[i].offset)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+RtnValue CallFunction(ValuePtr ptr,
+                      const HostValue* args,
+                      size_t argc,
+                      const char* strings,
+                      size_t strings_length) {
+  TraceSpan span("CallFunction");
+  m_value* fn = static_cast<m_value*>(ptr);
+  m_ctx* ctx = fn->context;
+  CallTimer timer(ctx->calls[kCallFunction]);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  timer.Phase(kPhaseLock);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  RtnValue rtn = {nullptr, nullptr};
+
+  Local<Value> value = fn->ptr.Get(isolate);
+  if (!value->IsFunction()) {
+    rtn.error.msg = CopyString("TypeError: value is not a function");
+    return rtn;
+  }
+
+  if (!HostStringsInBounds(args, argc, strings_length)) {
+    rtn.error.msg = CopyString("RangeError: string argument out of bounds");
+    return rtn;
+  }
+
+  std::vector<Local<Value>> argv;
+  argv.reserve(argc);
+  for (size_t i = 0; i < argc; i++) {
+    argv.push_back(HostToValue(isolate, args[i], strings));
+  }
+  timer.Phase(kPhaseMarshal);
+
+  MaybeLocal<Value> result = value.As<Function>()->Call(
+      context, context->Global(), argv.size(), argv.data());
+  timer.Phase(kPhaseExecute);
+  if (result.IsEmpty()) {
+    rtn.error = ExceptionError(try_catch, isolate, context);
+    return rtn;
+  }
+
+  m_value* val = new m_value;
+  val->context = ctx;
+  val->ptr.Reset(isolate, result.ToLocalChecked());
+  rtn.value = static_cast<ValuePtr>(val);
+  return rtn;
+}
+
+// Objects
+
+// Value::IsString, IsNull and IsUndefined are inlined and inspect the heap
+// object directly, which does not match the layout of the bundled V8 build,
+// so values are classified through the library instead
+bool IsStringValue(Local<Value> value) {
+  return value->IsName() && !value->IsSymbol();
+}
+
+int InternKey(ContextPtr ptr, const char* key, size_t length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  std::string name(key, length);
+  auto it = ctx->key_handles.find(name);
+  if (it != ctx->key_handles.end()) {
+    return it->second;
+  }
+
+  Local<String> str = String::NewFromUtf8(isolate, key,
+                                          NewStringType::kInternalized, length)
+                          .ToLocalChecked();
+  int handle = ctx->keys.size();
+  ctx->keys.emplace_back(isolate, str);
+  ctx->key_handles[name] = handle;
+  return handle;
+}
+
+ValuePtr NewObject(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  Context::Scope context_scope(ctx->ptr.Get(isolate));
+
+  m_value* val = new m_value;
+  val->context = ctx;
+  val->ptr.Reset(isolate, Object::New(isolate));
+  return static_cast<ValuePtr>(val);
+}
+
+RtnError KeyError() {
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+  rtn.msg = CopyString("RangeError: unknown key handle");
+  return rtn;
+}
+
+RtnError SetProperties(m_ctx* ctx,
+                       Local<Context> context,
+                       Local<Object> object,
+                       const int* keys,
+                       size_t count,
+                       const HostValue* values,
+                       const char* strings,
+                       size_t strings_length) {
+  Isolate* isolate = ctx->isolate;
+  TryCatch try_catch(isolate);
+
+  if (!HostStringsInBounds(values, count, strings_length)) {
+    RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+    rtn.msg = CopyString("RangeError: string value out of bounds");
+    return rtn;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    if (keys[i] < 0 || static_cast<size_t>(keys[i]) >= ctx->keys.size()) {
+      return KeyError();
+    }
+    Local<String> key = ctx->keys[keys[i]].Get(isolate);
+    if (object->Set(context, key, HostToValue(isolate, values[i], strings))
+            .IsNothing()) {
+      return ExceptionError(try_catch, isolate, context);
+    }
+  }
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+  return rtn;
+}
+
+RtnError SetMany(ValuePtr ptr,
+                 const int* keys,
+                 size_t count,
+                 const HostValue* values,
+                 const char* strings,
+                 size_t strings_length) {
+  m_value* val = static_cast<m_value*>(ptr);
+  m_ctx* ctx = val->context;
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  Local<Value> value = val->ptr.Get(isolate);
+  if (!value->IsObject()) {
+    RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+    rtn.msg = CopyString("TypeError: value is not an object");
+    return rtn;
+  }
+  return SetProperties(ctx, context, value.As<Object>(), keys, count, values,
+                       strings, strings_length);
+}
+
+RtnError SetGlobals(ContextPtr ptr,
+                    const int* keys,
+                    size_t count,
+                    const HostValue* values,
+                    const char* strings,
+                    size_t strings_length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  return SetProperties(ctx, context, context->Global(), keys, count, values,
+                       strings, strings_length);
+}
+
+RtnHostValues GetMany(ValuePtr ptr,
+                      const int* keys,
+                      size_t count,
+                      HostValue* values) {
+  m_value* val = static_cast<m_value*>(ptr);
+  m_ctx* ctx = val->context;
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  RtnHostValues rtn = {};
+
+  Local<Value> value = val->ptr.Get(isolate);
+  if (!value->IsObject()) {
+    rtn.error.msg = CopyString("TypeError: value is not an object");
+    return rtn;
+  }
+  Local<Object> object = value.As<Object>();
+
+  std::string strings;
+  size_t i = 0;
+  for (; i < count; i++) {
+    if (keys[i] < 0 || static_cast<size_t>(keys[i]) >= ctx->keys.size()) {
+      rtn.error = KeyError();
+      break;
+    }
+
+    Local<Value> property;
+    if (!object->Get(context, ctx->keys[keys[i]].Get(isolate))
+             .ToLocal(&property)) {
+      rtn.error = ExceptionError(try_catch, isolate, context);
+      break;
+    }
+
+    HostValue& out = values[i];
+    out = HostValue();
+    if (property->IsNumber()) {
+      out.kind = kHostNumber;
+      out.number = property->NumberValue(context).FromMaybe(0);
+    } else if (property->IsBoolean()) {
+      out.kind = kHostBoolean;
+      out.number = property->BooleanValue(isolate);
+    } else if (IsStringValue(property)) {
+      String::Utf8Value str(isolate, property);
+      out.kind = kHostString;
+      out.offset = strings.size();
+      out.length = str.length();
+      strings.append(*str, str.length());
+    } else if (property->StrictEquals(Undefined(isolate))) {
+      out.kind = kHostUndefined;
+    } else if (property->StrictEquals(Null(isolate))) {
+      out.kind = kHostNull;
+    } else {
+      m_value* result = new m_value;
+      result->context = ctx;
+      result->ptr.Reset(isolate, property);
+      out.kind = kHostValue;
+      out.value = static_cast<ValuePtr>(result);
+    }
+  }
+
+  // Values handed out before a failure are not returned, so release them
+  if (rtn.error.msg != nullptr) {
+    for (size_t j = 0; j < i; j++) {
+      if (values[j].kind == kHostValue) {
+        DisposeValue(values[j].value);
+      }
+    }
+    return rtn;
+  }
+
+  if (!strings.empty()) {
+    char* mem = (char*)malloc(strings.size());
+    memcpy(mem, strings.data(), strings.size());
+    rtn.strings.data = mem;
+    rtn.strings.length = strings.size();
+  }
+  return rtn;
+}
+
+// WebAssembly
+
+// Compiled Wasm modules are shared by all isolates of the process, keyed by
+// the hash of their wire bytes. Entries are only released by ClearWasmCache.
+std::mutex wasmCacheMutex;
+std::map<uint64_t, std::vector<CompiledWasmModule>> wasmCache;
+std::string wasmCacheDir;
+std::atomic<uint64_t> wasmCacheHits(0);
+std::atomic<uint64_t> wasmCacheMisses(0);
+std::atomic<uint64_t> wasmCacheDiskHits(0);
+
+// 64-bit FNV-1a
+uint64_t HashBytes(const char* data, size_t length) {
+  uint64_t hash = 14695981039346656037ull;
+  for (size_t i = 0; i < length; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// The hash and the length name the file, so a collision needs both to match
+std::string WasmCachePath(const std::string& dir,
+                          uint64_t hash,
+                          size_t length) {
+  char name[64];
+  snprintf(name, sizeof(name), "/%016llx-%zu.wasmcache",
+           static_cast<unsigned long long>(hash), length);
+  return dir + name;
+}
+
+// Cache files start with the V8 version and a hash of the serialized module.
+// DeserializeOrCompile silently compiles from the wire bytes when it cannot
+// use serialized data, so a file is only counted as a disk hit, and kept,
+// when it was written by this V8 version and is intact.
+std::string WasmCacheHeader(uint64_t payload_hash) {
+  std::string header = "V8WC";
+  header += V8::GetVersion();
+  header += '\0';
+  header.append(reinterpret_cast<const char*>(&payload_hash),
+                sizeof(payload_hash));
+  return header;
+}
+
+// Returns the serialized module in a cache file, or an empty span when the
+// file is stale or corrupt
+MemorySpan<const uint8_t> WasmCachePayload(const char* file, size_t length) {
+  std::string version = WasmCacheHeader(0);
+  size_t header_length = version.size();
+  version.resize(header_length - sizeof(uint64_t));
+  if (length <= header_length ||
+      memcmp(file, version.data(), version.size()) != 0) {
+    return MemorySpan<const uint8_t>();
+  }
+
+  uint64_t payload_hash;
+  memcpy(&payload_hash, file + version.size(), sizeof(payload_hash));
+  const char* payload = file + header_length;
+  size_t payload_length = length - header_length;
+  if (HashBytes(payload, payload_length) != payload_hash) {
+    return MemorySpan<const uint8_t>();
+  }
+  return MemorySpan<const uint8_t>(reinterpret_cast<const uint8_t*>(payload),
+                                   payload_length);
+}
+
+// Writes through a temporary file, so concurrent processes never read a
+// partial cache file
+void WriteWasmCacheFile(const std::string& path, const OwnedBuffer& data) {
+  std::string header = WasmCacheHeader(
+      HashBytes(reinterpret_cast<const char*>(data.buffer.get()), data.size));
+  std::string tmp = path + ".tmp" + std::to_string(getpid());
+  FILE* f = fopen(tmp.c_str(), "wb");
+  if (f == nullptr) {
+    return;
+  }
+  bool ok = fwrite(header.data(), 1, header.size(), f) == header.size() &&
+            fwrite(data.buffer.get(), 1, data.size, f) == data.size;
+  ok = fclose(f) == 0 && ok;
+  if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+    unlink(tmp.c_str());
+  }
+}
+
+bool LookupWasmCache(uint64_t hash,
+                     const char* data,
+                     size_t length,
+                     std::unique_ptr<CompiledWasmModule>* compiled) {
+  std::lock_guard<std::mutex> lock(wasmCacheMutex);
+  auto it = wasmCache.find(hash);
+  if (it == wasmCache.end()) {
+    return false;
+  }
+  for (CompiledWasmModule& module : it->second) {
+    MemorySpan<const uint8_t> wire = module.GetWireBytesRef();
+    if (wire.size() == length && memcmp(wire.data(), data, length) == 0) {
+      compiled->reset(new CompiledWasmModule(module));
+      return true;
+    }
+  }
+  return false;
+}
+
+void AddWasmCache(uint64_t hash,
+                  const char* data,
+                  size_t length,
+                  const CompiledWasmModule& compiled) {
+  std::unique_ptr<CompiledWasmModule> existing;
+  if (LookupWasmCache(hash, data, length, &existing)) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(wasmCacheMutex);
+  wasmCache[hash].push_back(compiled);
+}
+
+RtnValue NewWasmModule(m_ctx* ctx,
+                       const char* data,
+                       size_t length,
+                       MemorySpan<const uint8_t> serialized,
+                       uint64_t hash,
+                       OwnedBuffer* serialize_out) {
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+
+  RtnValue rtn = {nullptr, nullptr};
+
+  // Without usable serialized data the module is compiled from the wire
+  // bytes
+  Local<WasmModuleObject> module;
+  if (!WasmModuleObject::DeserializeOrCompile(
+           isolate, serialized,
+           MemorySpan<const uint8_t>(
+               reinterpret_cast<const uint8_t*>(data), length))
+           .ToLocal(&module)) {
+    rtn.error = ExceptionError(try_catch, isolate, context);
+    return rtn;
+  }
+
+  CompiledWasmModule compiled = module->GetCompiledModule();
+  AddWasmCache(hash, data, length, compiled);
+  if (serialize_out != nullptr) {
+    *serialize_out = compiled.Serialize();
+  }
+
+  m_value* val = new m_value;
+  val->context = ctx;
+  val->ptr.Reset(isolate, module);
+  rtn.value = static_cast<ValuePtr>(val);
+  return rtn;
+}
+
+RtnValue CompileWasm(ContextPtr ptr, const char* data, size_t length) {
+  TraceSpan span("CompileWasm");
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  uint64_t hash = HashBytes(data, length);
+
+  std::unique_ptr<CompiledWasmModule> compiled;
+  if (LookupWasmCache(hash, data, length, &compiled)) {
+    wasmCacheHits++;
+
+    Locker locker(isolate);
+    Isolate::Scope isolate_scope(isolate);
+    HandleScope handle_scope(isolate);
+    TryCatch try_catch(isolate);
+
+    Local<Context> context = ctx->ptr.Get(isolate);
+    Context::Scope context_scope(context);
+
+    RtnValue rtn = {nullptr, nullptr};
+    Local<WasmModuleObject> module;
+    if (!WasmModuleObject::FromCompiledModule(isolate, *compiled)
+             .ToLocal(&module)) {
+      rtn.error = ExceptionError(try_catch, isolate, context);
+      return rtn;
+    }
+
+    m_value* val = new m_value;
+    val->context = ctx;
+    val->ptr.Reset(isolate, module);
+    rtn.value = static_cast<ValuePtr>(val);
+    return rtn;
+  }
+  wasmCacheMisses++;
+
+  std::string dir;
+  {
+    std::lock_guard<std::mutex> lock(wasmCacheMutex);
+    dir = wasmCacheDir;
+  }
+  if (dir.empty()) {
+    return NewWasmModule(ctx, data, length, MemorySpan<const uint8_t>(), hash,
+                         nullptr);
+  }
+
+  std::string path = WasmCachePath(dir, hash, length);
+  size_t file_length = 0;
+  std::shared_ptr<void> mapping = MapFile(path.c_str(), &file_length);
+  MemorySpan<const uint8_t> serialized;
+  if (mapping) {
+    serialized = WasmCachePayload(static_cast<const char*>(mapping.get()),
+                                  file_length);
+  }
+  if (serialized.size() > 0) {
+    RtnValue rtn = NewWasmModule(ctx, data, length, serialized, hash, nullptr);
+    if (rtn.value != nullptr) {
+      wasmCacheDiskHits++;
+    }
+    return rtn;
+  }
+
+  // Missing or stale, so the module is compiled and the file (re)written
+  OwnedBuffer out;
+  RtnValue rtn = NewWasmModule(ctx, data, length, serialized, hash, &out);
+  if (rtn.value != nullptr && out.size > 0) {
+    WriteWasmCacheFile(path, out);
+  }
+  return rtn;
+}
+
+RtnBytes SerializeWasm(ValuePtr ptr) {
+  m_value* val = static_cast<m_value*>(ptr);
+  m_ctx* ctx = val->context;
+  Isolate* isolate = ctx->isolate;
+  RtnBytes rtn = {nullptr, 0};
+
+  std::unique_ptr<CompiledWasmModule> compiled;
+  {
+    Locker locker(isolate);
+    Isolate::Scope isolate_scope(isolate);
+    HandleScope handle_scope(isolate);
+
+    Local<Value> value = val->ptr.Get(isolate);
+    if (!value->IsWebAssemblyCompiledModule()) {
+      return rtn;
+    }
+    Local<WasmModuleObject> module = value.As<WasmModuleObject>();
+    compiled.reset(new CompiledWasmModule(module->GetCompiledModule()));
+  }
+
+  OwnedBuffer buffer = compiled->Serialize();
+  if (buffer.size == 0) {
+    return rtn;
+  }
+  char* mem = (char*)malloc(buffer.size);
+  memcpy(mem, buffer.buffer.get(), buffer.size);
+  rtn.data = mem;
+  rtn.length = buffer.size;
+  return rtn;
+}
+
+RtnValue DeserializeWasm(ContextPtr ptr,
+                         const char* serialized,
+                         size_t serialized_length,
+                         const char* data,
+                         size_t length) {
+  TraceSpan span("DeserializeWasm");
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return NewWasmModule(
+      ctx, data, length,
+      MemorySpan<const uint8_t>(reinterpret_cast<const uint8_t*>(serialized),
+                                serialized_length),
+      HashBytes(data, length), nullptr);
+}
+
+void SetWasmCacheDir(const char* dir) {
+  std::lock_guard<std::mutex> lock(wasmCacheMutex);
+  wasmCacheDir = dir != nullptr ? dir : "";
+}
+
+void ClearWasmCache() {
+  std::lock_guard<std::mutex> lock(wasmCacheMutex);
+  wasmCache.clear();
+}
+
+WasmCacheStats GetWasmCacheStats() {
+  WasmCacheStats stats = {};
+  {
+    std::lock_guard<std::mutex> lock(wasmCacheMutex);
+    for (auto& entry : wasmCache) {
+      stats.modules += entry.second.size();
+    }
+  }
+  stats.hits = wasmCacheHits;
+  stats.misses = wasmCacheMisses;
+  stats.disk_hits = wasmCacheDiskHits;
+  return stats;
+}
+
+// Modules
+
+void TouchModule(m_ctx* ctx, m_module* mod) {
+  ctx->module_lru.splice(ctx->module_lru.begin(), ctx->module_lru, mod->lru);
+}
+
+void ReleaseModule(m_ctx* ctx, m_module* mod) {
+  for (auto& dep : mod->resolved) {
+    auto it = ctx->modules.find(dep.second);
+    if (it != ctx->modules.end() && it->second->refs > 0) {
+      it->second->refs--;
+    }
+  }
+
+  auto by_hash = ctx->modules_by_hash.find(mod->hash);
+  if (by_hash != ctx->modules_by_hash.end() && by_hash->second == mod) {
+    ctx->modules_by_hash.erase(by_hash);
+  }
+  ctx->module_lru.erase(mod->lru);
+  ctx->module_bytes -= mod->bytes;
+
+  mod->ptr.Reset();
+  delete mod;
+}
+
+void EvictModules(m_ctx* ctx, m_module* keep) {
+  if (ctx->module_bytes_limit == 0) {
+    return;
+  }
+
+  // Evicting a module can release the last reference to its dependencies,
+  // so passes repeat until the limit is met or nothing more can go
+  bool evicted = true;
+  while (evicted && ctx->module_bytes > ctx->module_bytes_limit) {
+    evicted = false;
+    auto it = ctx->module_lru.end();
+    while (ctx->module_bytes > ctx->module_bytes_limit &&
+           it != ctx->module_lru.begin()) {
+      m_module* mod = *--it;
+      if (mod == keep || mod->refs > 0) {
+        continue;
+      }
+
+      it = std::next(it);
+      ctx->modules.erase(mod->name);
+      ReleaseModule(ctx, mod);
+      ctx->modules_evicted++;
+      evicted = true;
+    }
+  }
+}
+
+ScriptOrigin ModuleOrigin(Isolate* isolate, Local<String> name) {
+  Local<Integer> resource_line_offset = Integer::New(isolate, 0);
+  Local<Integer> resource_column_offset = Integer::New(isolate, 0);
+  Local<Boolean> resource_is_shared_cross_origin = True(isolate);
+  Local<Integer> script_id = Local<Integer>();
+  Local<Value> source_map_url = Local<Value>();
+  Local<Boolean> resource_is_opaque = False(isolate);
+  Local<Boolean> is_wasm = False(isolate);
+  Local<Boolean> is_module = True(isolate);
+  Local<PrimitiveArray> host_defined_options = Local<PrimitiveArray>();
+
+  return ScriptOrigin(name, resource_line_offset, resource_column_offset,
+                      resource_is_shared_cross_origin, script_id,
+                      source_map_url, resource_is_opaque, is_wasm, is_module,
+                      host_defined_options);
+}
+
+// Creates the record of a compiled module, which is not in the cache yet
+m_module* NewModule(m_ctx* ctx,
+                    Local<Module> module,
+                    const std::string& name,
+                    size_t bytes) {
+  m_module* mod = new m_module;
+  mod->ptr.Reset(ctx->isolate, module);
+  mod->name = name;
+  mod->hash = module->GetIdentityHash();
+  mod->bytes = bytes;
+  mod->refs = 0;
+  return mod;
+}
+
+// Frees a staged module that failed to instantiate or evaluate
+void DiscardModule(m_ctx* ctx, m_module* mod) {
+  ctx->staged_modules.erase(mod->name);
+  mod->ptr.Reset();
+  delete mod;
+}
+
+void RegisterModule(m_ctx* ctx, m_module* mod) {
+  // Reloading a module under the same name replaces the previous version;
+  // anything that imported the old version keeps it alive inside V8, but the
+  // cache only tracks the latest one.
+  auto existing = ctx->modules.find(mod->name);
+  if (existing != ctx->modules.end()) {
+    mod->refs = existing->second->refs;
+    ReleaseModule(ctx, existing->second);
+  }
+
+  ctx->module_lru.push_front(mod);
+  mod->lru = ctx->module_lru.begin();
+  ctx->module_bytes += mod->bytes;
+  ctx->modules[mod->name] = mod;
+  ctx->modules_by_hash[mod->hash] = mod;
+}
+
+void LinkModule(m_ctx* ctx,
+                m_module* mod,
+                const std::map<std::string, std::string>& resolved) {
+  mod->resolved = resolved;
+  for (auto& dep : resolved) {
+    m_module* depModule = ctx->modules[dep.second];
+    depModule->refs++;
+    TouchModule(ctx, depModule);
+  }
+}
+
+// V8 expects the resolve callback to throw when it returns no module
+MaybeLocal<Module> ResolveFailed(Isolate* isolate, const char* specifier) {
+  std::string msg =
+      std::string("ResolveError: cannot resolve '") + specifier + "'";
+  isolate->ThrowException(
+      String::NewFromUtf8(isolate, msg.data(), NewStringType::kNormal,
+                          msg.size())
+          .ToLocalChecked());
+  return MaybeLocal<Module>();
+}
+
+MaybeLocal<Module> ResolveCallback(Local<Context> context,
+                                   Local<String> specifier,
+                                   Local<Module> referrer) {
+  Isolate* isolate = Isolate::GetCurrent();
+  m_ctx* ctx = (m_ctx*)isolate->GetData(0);
+
+  HandleScope handle_scope(isolate);
+
+  String::Utf8Value str(isolate, specifier);
+  const char* moduleName = *str;
+
+  m_module* referrerModule = nullptr;
+  for (auto& staged : ctx->staged_modules) {
+    if (staged.second->ptr.Get(isolate) == referrer) {
+      referrerModule = staged.second;
+      break;
+    }
+  }
+  if (referrerModule == nullptr) {
+    auto referrerIt = ctx->modules_by_hash.find(referrer->GetIdentityHash());
+    if (referrerIt == ctx->modules_by_hash.end()) {
+      return ResolveFailed(isolate, moduleName);
+    }
+    referrerModule = referrerIt->second;
+  }
+
+  std::map<std::string, std::string>& localResolve = referrerModule->resolved;
+  auto nameIt = localResolve.find(moduleName);
+  if (nameIt == localResolve.end()) {
+    return ResolveFailed(isolate, moduleName);
+  }
+
+  auto staged = ctx->staged_modules.find(nameIt->second);
+  if (staged != ctx->staged_modules.end()) {
+    return staged->second->ptr.Get(isolate);
+  }
+
+  auto it = ctx->modules.find(nameIt->second);
+  if (it == ctx->modules.end()) {
+    return ResolveFailed(isolate, moduleName);
+  }
+
+  TouchModule(ctx, it->second);
+  return it->second->ptr.Get(isolate);
+}
+
+// Error of a module that failed to instantiate or evaluate. V8 reports some
+// failures, such as a resolve callback returning no module, without an
+// exception.
+RtnError ModuleError(TryCatch& try_catch,
+                     Isolate* isolate,
+                     Local<Context> context,
+                     const std::string& name,
+                     const char* step) {
+  if (try_catch.HasCaught()) {
+    return ExceptionError(try_catch, isolate, context);
+  }
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+  rtn.msg = CopyString("ResolveError: module '" + name + "' could not be " +
+                       step);
+  return rtn;
+}
+
+RtnError LoadModule(ContextPtr ptr,
+                    const char* source_s,
+                    size_t source_length,
+                    const char* name_p,
+                    size_t name_length,
+                    int callback_index) {
+  TraceSpan span("LoadModule");
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  CallTimer timer(ctx->calls[kCallLoadModule]);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  timer.Phase(kPhaseLock);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  // The resolver callback needs a NUL-terminated referrer name
+  std::string referrer(name_p, name_length);
+  const char* name_s = referrer.c_str();
+
+  Local<String> name =
+      String::NewFromUtf8(isolate, name_p, NewStringType::kNormal, name_length)
+          .ToLocalChecked();
+  Local<String> source_text =
+      NewSourceString(isolate, source_s, source_length, nullptr)
+          .ToLocalChecked();
+
+  ScriptOrigin origin = ModuleOrigin(isolate, name);
+
+  ScriptCompiler::Source source(source_text, origin);
+  Local<Module> module;
+
+  bool compiled =
+      ScriptCompiler::CompileModule(isolate, &source).ToLocal(&module);
+  timer.Phase(kPhaseCompile);
+  if (!compiled) {
+    assert(try_catch.HasCaught());
+    return ExceptionError(try_catch, isolate, context);
+  }
+
+  std::map<std::string, std::string> resolved;
+
+  for (int i = 0; i < module->GetModuleRequestsLength(); i++) {
+    Local<String> dependency = module->GetModuleRequest(i);
+    String::Utf8Value str(isolate, dependency);
+    char* dependencySpecifier = *str;
+
+    auto retval = ResolveModule(dependencySpecifier,
+                                const_cast<char*>(name_s), callback_index);
+    std::string canonicalName = retval.r0 == nullptr ? "" : retval.r0;
+    free(retval.r0);
+
+    if (retval.r1 != 0) {
+      std::ostringstream sb;
+      sb << "ResolveError: cannot resolve '" << dependencySpecifier
+         << "' from '" << name_s << "' (resolver returned " << retval.r1
+         << ")";
+      rtn.msg = CopyString(sb.str());
+      return rtn;
+    }
+
+    if (ctx->modules.count(canonicalName) == 0) {
+      std::ostringstream sb;
+      sb << "ResolveError: module '" << canonicalName << "' imported by '"
+         << name_s << "' is not loaded";
+      rtn.msg = CopyString(sb.str());
+      return rtn;
+    }
+
+    resolved[dependencySpecifier] = canonicalName;
+  }
+
+  // A module that fails to instantiate or evaluate is not cached, and does
+  // not replace a working version of the same name
+  m_module* mod = NewModule(ctx, module, referrer, source_length + name_length);
+  mod->resolved = resolved;
+  ctx->staged_modules[referrer] = mod;
+
+  Maybe<bool> ok = module->InstantiateModule(context, ResolveCallback);
+  if (!ok.FromMaybe(false)) {
+    DiscardModule(ctx, mod);
+    return ModuleError(try_catch, isolate, context, referrer, "instantiated");
+  }
+
+  MaybeLocal<Value> result = module->Evaluate(context);
+  timer.Phase(kPhaseExecute);
+
+  if (result.IsEmpty()) {
+    DiscardModule(ctx, mod);
+    rtn = ModuleError(try_catch, isolate, context, referrer, "evaluated");
+    timer.Phase(kPhaseMarshal);
+    return rtn;
+  }
+
+  ctx->staged_modules.erase(referrer);
+  RegisterModule(ctx, mod);
+  LinkModule(ctx, mod, resolved);
+  EvictModules(ctx, mod);
+  return rtn;
+}
+
+// Module bundles
+//
+// A bundle is a little-endian binary image holding a pre-resolved module
+// graph, so it can be loaded without calling back into the resolver:
+//
+//   header        "V8MB" | u32 version | u32 module count | u32 reserved
+//   modules       per module: u32 name offset, name length, source offset,
+//                 source length, code cache offset, code cache length,
+//                 dependency offset, dependency count
+//   dependencies  per dependency: u32 specifier offset, specifier length,
+//                 index of the target module in the bundle, reserved
+//   data          names, sources and specifiers; code caches 8-byte aligned
+//
+// All offsets are relative to the start of the bundle, so it can be mapped
+// straight from disk.
+
+const uint32_t kBundleVersion = 1;
+const size_t kBundleHeaderSize = 16;
+const size_t kBundleModuleSize = 32;
+const size_t kBundleDependencySize = 16;
+
+uint32_t ReadU32(const char* p) {
+  const uint8_t* b = reinterpret_cast<const uint8_t*>(p);
+  return b[0] | (b[1] << 8) | (b[2] << 16) | (uint32_t(b[3]) << 24);
+}
+
+bool InBundle(size_t length, uint32_t offset, uint64_t size) {
+  return offset <= length && size <= length - offset;
+}
+
+RtnError BundleError() {
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+  rtn.msg = CopyString("BundleError: malformed module bundle");
+  return rtn;
+}
+
+RtnError LoadBundle(m_ctx* ctx,
+                    const char* data,
+                    size_t length,
+                    std::shared_ptr<void> backing) {
+  TraceSpan span("LoadModuleBundle");
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+
+  if (length < kBundleHeaderSize || memcmp(data, "V8MB", 4) != 0 ||
+      ReadU32(data + 4) != kBundleVersion) {
+    return BundleError();
+  }
+
+  uint32_t count = ReadU32(data + 8);
+  if (!InBundle(length, kBundleHeaderSize, uint64_t(count) * kBundleModuleSize)) {
+    return BundleError();
+  }
+
+  // Every table is validated before anything is compiled or registered, so
+  // a malformed bundle leaves the module cache untouched
+  std::vector<std::map<std::string, uint32_t>> deps(count);
+  std::set<std::string> names;
+  for (uint32_t i = 0; i < count; i++) {
+    const char* entry = data + kBundleHeaderSize + i * kBundleModuleSize;
+    uint32_t deps_off = ReadU32(entry + 24), deps_count = ReadU32(entry + 28);
+    if (!InBundle(length, ReadU32(entry), ReadU32(entry + 4)) ||
+        !InBundle(length, ReadU32(entry + 8), ReadU32(entry + 12)) ||
+        !InBundle(length, ReadU32(entry + 16), ReadU32(entry + 20)) ||
+        !InBundle(length, deps_off,
+                  uint64_t(deps_count) * kBundleDependencySize)) {
+      return BundleError();
+    }
+    // Module names are unique within a bundle
+    if (!names.insert(std::string(data + ReadU32(entry), ReadU32(entry + 4)))
+             .second) {
+      return BundleError();
+    }
+
+    for (uint32_t j = 0; j < deps_count; j++) {
+      const char* dep = data + deps_off + j * kBundleDependencySize;
+      uint32_t spec_off = ReadU32(dep), spec_len = ReadU32(dep + 4);
+      uint32_t target = ReadU32(dep + 8);
+      if (!InBundle(length, spec_off, spec_len) || target >= count) {
+        return BundleError();
+      }
+      deps[i][std::string(data + spec_off, spec_len)] = target;
+    }
+  }
+
+  std::vector<m_module*> records;
+  for (uint32_t i = 0; i < count; i++) {
+    const char* entry = data + kBundleHeaderSize + i * kBundleModuleSize;
+    uint32_t name_off = ReadU32(entry), name_len = ReadU32(entry + 4);
+    uint32_t source_off = ReadU32(entry + 8), source_len = ReadU32(entry + 12);
+    uint32_t cache_off = ReadU32(entry + 16), cache_len = ReadU32(entry + 20);
+
+    Local<String> name =
+        String::NewFromUtf8(isolate, data + name_off, NewStringType::kNormal,
+                            name_len)
+            .ToLocalChecked();
+    Local<String> source_text =
+        NewSourceString(isolate, data + source_off, source_len, backing)
+            .ToLocalChecked();
+
+    ScriptCompiler::CachedData* cache = nullptr;
+    ScriptCompiler::CompileOptions options = ScriptCompiler::kNoCompileOptions;
+    if (cache_len > 0) {
+      cache = new ScriptCompiler::CachedData(
+          reinterpret_cast<const uint8_t*>(data + cache_off), cache_len);
+      options = ScriptCompiler::kConsumeCodeCache;
+    }
+
+    ScriptOrigin origin = ModuleOrigin(isolate, name);
+    ScriptCompiler::Source source(source_text, origin, cache);
+    Local<Module> module;
+
+    if (!ScriptCompiler::CompileModule(isolate, &source, options)
+             .ToLocal(&module)) {
+      assert(try_catch.HasCaught());
+      return ExceptionError(try_catch, isolate, context);
+    }
+
+    // Every import needs an entry in the dependency table
+    std::string module_name(data + name_off, name_len);
+    for (int j = 0; j < module->GetModuleRequestsLength(); j++) {
+      String::Utf8Value specifier(isolate, module->GetModuleRequest(j));
+      if (deps[i].count(*specifier) == 0) {
+        std::ostringstream sb;
+        sb << "ResolveError: cannot resolve '" << *specifier << "' from '"
+           << module_name << "' in the bundle";
+        rtn.msg = CopyString(sb.str());
+        return rtn;
+      }
+    }
+
+    records.push_back(NewModule(ctx, module, module_name, source_len + name_len));
+  }
+
+  // The modules are staged while they instantiate and evaluate, so a failed
+  // bundle neither stays half loaded nor replaces loaded modules of the same
+  // names
+  for (uint32_t i = 0; i < count; i++) {
+    for (auto& dep : deps[i]) {
+      records[i]->resolved[dep.first] = records[dep.second]->name;
+    }
+    ctx->staged_modules[records[i]->name] = records[i];
+  }
+
+  for (m_module* record : records) {
+    Local<Module> module = record->ptr.Get(isolate);
+    Maybe<bool> ok = module->InstantiateModule(context, ResolveCallback);
+    if (!ok.FromMaybe(false)) {
+      rtn = ModuleError(try_catch, isolate, context, record->name,
+                        "instantiated");
+    } else if (module->Evaluate(context).IsEmpty()) {
+      rtn = ModuleError(try_catch, isolate, context, record->name,
+                        "evaluated");
+    } else {
+      continue;
+    }
+
+    for (m_module* staged : records) {
+      DiscardModule(ctx, staged);
+    }
+    return rtn;
+  }
+
+  for (m_module* record : records) {
+    ctx->staged_modules.erase(record->name);
+    RegisterModule(ctx, record);
+  }
+  for (m_module* record : records) {
+    LinkModule(ctx, record, record->resolved);
+  }
+
+  EvictModules(ctx, nullptr);
+  return rtn;
+}
+
+RtnError LoadModuleBundle(ContextPtr ptr, const char* data, size_t length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return LoadBundle(ctx, data, length, nullptr);
+}
+
+RtnError LoadModuleBundleFile(ContextPtr ptr, const char* path) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+
+  size_t length = 0;
+  std::shared_ptr<void> mapping = MapFile(path, &length);
+  if (!mapping) {
+    return FileError(path);
+  }
+
+  return LoadBundle(ctx, static_cast<const char*>(mapping.get()), length,
+                    mapping);
+}
+
+RtnBytes CompileModuleCodeCache(ContextPtr ptr,
+                                const char* source_s,
+                                size_t source_length,
+                                const char* name_s,
+                                size_t name_length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  TryCatch try_catch(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+
+  RtnBytes rtn = {nullptr, 0};
+
+  Local<String> name =
+      String::NewFromUtf8(isolate, name_s, NewStringType::kNormal, name_length)
+          .ToLocalChecked();
+  Local<String> source_text =
+      String::NewFromUtf8(isolate, source_s, NewStringType::kNormal,
+                          source_length)
+          .ToLocalChecked();
+
+  // The cache has to be created before the module is evaluated, so this
+  // compiles a throwaway copy instead of using the loaded module
+  ScriptOrigin origin = ModuleOrigin(isolate, name);
+  ScriptCompiler::Source source(source_text, origin);
+  Local<Module> module;
+  if (!ScriptCompiler::CompileModule(isolate, &source).ToLocal(&module)) {
+    return rtn;
+  }
+
+  std::unique_ptr<ScriptCompiler::CachedData> cache(
+      ScriptCompiler::CreateCodeCache(module->GetUnboundModuleScript()));
+  if (!cache) {
+    return rtn;
+  }
+
+  char* mem = (char*)malloc(cache->length);
+  memcpy(mem, cache->data, cache->length);
+  rtn.data = mem;
+  rtn.length = cache->length;
+  return rtn;
+}
+
+int UnloadModule(ContextPtr ptr, const char* name) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+
+  auto it = ctx->modules.find(name);
+  if (it == ctx->modules.end()) {
+    return 1;
+  }
+
+  if (it->second->refs > 0) {
+    return 2;
+  }
+
+  m_module* mod = it->second;
+  ctx->modules.erase(it);
+  ReleaseModule(ctx, mod);
+  return 0;
+}
+
+void SetModuleCacheLimit(ContextPtr ptr, size_t bytes) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+
+  ctx->module_bytes_limit = bytes;
+  EvictModules(ctx, nullptr);
+}
+
+ModuleStats GetModuleStats(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+
+  ModuleStats stats;
+  stats.count = ctx->modules.size();
+  stats.bytes = ctx->module_bytes;
+  stats.limit = ctx->module_bytes_limit;
+  stats.evicted = ctx->modules_evicted;
+  return stats;
+}
+
+ArrayBufferStats GetArrayBufferStats(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  PooledAllocator* allocator = ctx->allocator;
+
+  ArrayBufferStats stats;
+  stats.allocated = allocator->allocated();
+  stats.peak = allocator->peak();
+  stats.limit = allocator->limit();
+  stats.failed = allocator->failed();
+  return stats;
+}
+
+// Microtasks
+
+void RunMicrotasks(m_ctx* ctx) {
+  if (ctx->microtask_queue) {
+    ctx->microtask_queue->PerformCheckpoint(ctx->isolate);
+  } else {
+    ctx->isolate->RunMicrotasks();
+  }
+}
+
+void PerformMicrotaskCheckpoint(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+  Context::Scope context_scope(ctx->ptr.Get(isolate));
+
+  RunMicrotasks(ctx);
+}
+
+// Event loop
+
+RtnError Tick(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+
+  RtnError rtn = {nullptr, nullptr, nullptr, kErrorException};
+
+  while (platform::PumpMessageLoop(defaultPlatform.get(), isolate)) {
+  }
+
+  std::vector<uint64_t> expired;
+  ctx->timer_wheel->Advance(LoopNow(ctx), &expired);
+
+  for (size_t i = 0; i < expired.size(); i++) {
+    uint32_t id = static_cast<uint32_t>(expired[i]);
+    auto it = ctx->timers.find(id);
+    if (it == ctx->timers.end()) {
+      continue;
+    }
+
+    // After an error the remaining timers run on the next tick
+    if (rtn.msg != nullptr) {
+      ctx->timer_wheel->Add(id, 0);
+      continue;
+    }
+
+    m_timer* timer = it->second;
+    HandleScope timer_scope(isolate);
+    Local<Function> callback = timer->callback.Get(isolate);
+    std::vector<Local<Value>> args;
+    for (auto& arg : timer->args) {
+      args.push_back(arg.Get(isolate));
+    }
+    uint64_t interval = timer->interval;
+    if (interval == 0) {
+      delete timer;
+      ctx->timers.erase(it);
+    }
+
+    TryCatch try_catch(isolate);
+    MaybeLocal<Value> result = callback->Call(context, context->Global(),
+                                              args.size(), args.data());
+    if (result.IsEmpty()) {
+      rtn = ExceptionError(try_catch, isolate, context);
+    }
+    RunMicrotasks(ctx);
+
+    // The callback may have cleared its own interval
+    if (interval != 0 && ctx->timers.count(id) != 0) {
+      ctx->timer_wheel->Add(id, LoopNow(ctx) + interval);
+    }
+  }
+
+  return rtn;
+}
+
+int64_t NextTimer(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Locker locker(ctx->isolate);
+
+  if (ctx->timers.empty()) {
+    return -1;
+  }
+  uint64_t due = ctx->timer_wheel->Now() + ctx->timer_wheel->NextTick();
+  uint64_t now = LoopNow(ctx);
+  return due > now ? due - now : 0;
+}
+
+// Ticks until no timers are left, a timer callback throws or StopLoop is
+// called with the same flag. The isolate is unlocked while waiting, so other
+// calls can enter it in between.
+RtnError RunLoop(ContextPtr ptr, int* stop) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  for (;;) {
+    RtnError rtn = Tick(ptr);
+    if (rtn.msg != nullptr) {
+      return rtn;
+    }
+
+    int64_t next = NextTimer(ptr);
+    std::unique_lock<std::mutex> lock(ctx->loop_mutex);
+    if (next < 0 || *stop) {
+      return rtn;
+    }
+    ctx->loop_cv.wait_for(lock, std::chrono::milliseconds(next), [&] {
+      return ctx->loop_wakeup || *stop;
+    });
+    ctx->loop_wakeup = false;
+  }
+}
+
+void StopLoop(ContextPtr ptr, int* stop) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  std::lock_guard<std::mutex> lock(ctx->loop_mutex);
+  *stop = 1;
+  ctx->loop_cv.notify_all();
+}
+
+// Log buffer
+
+size_t DrainLog(ContextPtr ptr, char* buf, size_t length) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return ctx->log == nullptr ? 0 : ctx->log->Drain(buf, length);
+}
+
+uint64_t GetLogDropped(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return ctx->log == nullptr ? 0 : ctx->log->Dropped();
+}
+
+// Heap
+
+void MemoryPressure(ContextPtr ptr, int level) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  // Safe to call from any thread; V8 schedules the GC on the isolate's own
+  // thread if it is busy
+  ctx->isolate->MemoryPressureNotification(
+      static_cast<MemoryPressureLevel>(level));
+}
+
+void SetIdle(ContextPtr ptr, int idle) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+
+  isolate->SetIdle(idle != 0);
+  if (idle) {
+    isolate->IsolateInBackgroundNotification();
+  } else {
+    isolate->IsolateInForegroundNotification();
+  }
+}
+
+int IdleNotification(ContextPtr ptr, double idle_time_in_seconds) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  double deadline =
+      defaultPlatform->MonotonicallyIncreasingTime() + idle_time_in_seconds;
+
+  // Run foreground tasks V8 posted while the engine was not entered, such as
+  // the GC requested by MemoryPressure
+  while (defaultPlatform->MonotonicallyIncreasingTime() < deadline &&
+         platform::PumpMessageLoop(defaultPlatform.get(), isolate)) {
+  }
+
+  bool done = isolate->IdleNotificationDeadline(deadline);
+
+  double remaining = deadline - defaultPlatform->MonotonicallyIncreasingTime();
+  if (remaining > 0) {
+    platform::RunIdleTasks(defaultPlatform.get(), isolate, remaining);
+  }
+
+  return done ? 1 : 0;
+}
+
+HeapStats GetHeapStats(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+
+  HeapStatistics hs;
+  isolate->GetHeapStatistics(&hs);
+
+  HeapStats stats;
+  stats.total_heap_size = hs.total_heap_size();
+  stats.total_heap_size_executable = hs.total_heap_size_executable();
+  stats.total_physical_size = hs.total_physical_size();
+  stats.total_available_size = hs.total_available_size();
+  stats.used_heap_size = hs.used_heap_size();
+  stats.heap_size_limit = hs.heap_size_limit();
+  stats.malloced_memory = hs.malloced_memory();
+  stats.peak_malloced_memory = hs.peak_malloced_memory();
+  stats.external_memory = hs.external_memory();
+  stats.number_of_native_contexts = hs.number_of_native_contexts();
+  stats.number_of_detached_contexts = hs.number_of_detached_contexts();
+  return stats;
+}
+
+size_t GetHeapSpaceStats(ContextPtr ptr, HeapSpaceStats* spaces, size_t n) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+
+  size_t count = isolate->NumberOfHeapSpaces();
+  for (size_t i = 0; i < count && i < n; i++) {
+    HeapSpaceStatistics hs;
+    isolate->GetHeapSpaceStatistics(&hs, i);
+
+    // Space names are static strings owned by V8
+    spaces[i].name = hs.space_name();
+    spaces[i].space_size = hs.space_size();
+    spaces[i].space_used_size = hs.space_used_size();
+    spaces[i].space_available_size = hs.space_available_size();
+    spaces[i].physical_space_size = hs.physical_space_size();
+  }
+  return count;
+}
+
+HistogramSnapshot GetGCStats(ContextPtr ptr, int gc_type) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return ctx->gc_pauses[gc_type].Snapshot();
+}
+
+HistogramSnapshot GetCallStats(ContextPtr ptr, int call, int phase) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  return ctx->calls[call][phase].Snapshot();
+}
+
+HistogramSnapshot GetProcessCallStats(int call, int phase) {
+  return processCalls[call][phase].Snapshot();
+}
+
+// Profiling
+
+const char* kCPUProfileTitle = "v8engine";
+
+int64_t WallClockNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+int StartCPUProfile(ContextPtr ptr, int interval_us) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  if (ctx->cpu_profiler != nullptr) {
+    return 1;
+  }
+
+  ctx->cpu_profiler = CpuProfiler::New(isolate);
+  ctx->cpu_profiler->SetSamplingInterval(interval_us);
+  ctx->cpu_profile_interval = interval_us;
+  ctx->cpu_profile_start = WallClockNanos();
+
+  Local<String> title =
+      String::NewFromUtf8(isolate, kCPUProfileTitle, NewStringType::kNormal)
+          .ToLocalChecked();
+  ctx->cpu_profiler->StartProfiling(title, true);
+
+  // V8's sampler interrupts the isolate's thread with SIGPROF, but installs
+  // its handler without SA_ONSTACK, which the Go runtime requires of every
+  // handler that can run on a goroutine stack
+  struct sigaction sa;
+  if (sigaction(SIGPROF, nullptr, &sa) == 0 && !(sa.sa_flags & SA_ONSTACK)) {
+    sa.sa_flags |= SA_ONSTACK;
+    sigaction(SIGPROF, &sa, nullptr);
+  }
+  return 0;
+}
+
+uint64_t CPUProfileLocation(ProfileBuilder& builder,
+                            std::map<unsigned, uint64_t>& locations,
+                            const CpuProfileNode* node) {
+  auto it = locations.find(node->GetNodeId());
+  if (it != locations.end()) {
+    return it->second;
+  }
+
+  std::string name = node->GetFunctionNameStr();
+  if (name.empty()) {
+    name = "(anonymous)";
+  }
+  uint64_t id =
+      builder.Location(name, node->GetScriptResourceNameStr(),
+                       node->GetLineNumber(), node->GetLineNumber());
+  locations[node->GetNodeId()] = id;
+  return id;
+}
+
+RtnBytes StopCPUProfile(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  RtnBytes rtn = {nullptr, 0};
+
+  if (ctx->cpu_profiler == nullptr) {
+    return rtn;
+  }
+
+  Local<String> title =
+      String::NewFromUtf8(isolate, kCPUProfileTitle, NewStringType::kNormal)
+          .ToLocalChecked();
+  CpuProfile* profile = ctx->cpu_profiler->StopProfiling(title);
+
+  int64_t interval_ns = int64_t(ctx->cpu_profile_interval) * 1000;
+
+  ProfileBuilder builder;
+  builder.AddSampleType("samples", "count");
+  builder.AddSampleType("cpu", "nanoseconds");
+  builder.SetPeriod("cpu", "nanoseconds", interval_ns);
+
+  if (profile != nullptr) {
+    builder.SetTime(ctx->cpu_profile_start,
+                    (profile->GetEndTime() - profile->GetStartTime()) * 1000);
+
+    std::map<unsigned, uint64_t> locations;
+    std::vector<uint64_t> stack;
+    std::vector<int64_t> values = {1, interval_ns};
+
+    for (int i = 0; i < profile->GetSamplesCount(); i++) {
+      stack.clear();
+      // The root node is synthetic, so stop before it
+      for (const CpuProfileNode* node = profile->GetSample(i);
+           node != nullptr && node->GetParent() != nullptr;
+           node = node->GetParent()) {
+        stack.push_back(CPUProfileLocation(builder, locations, node));
+      }
+      builder.AddSample(stack, values);
+    }
+
+    profile->Delete();
+  }
+
+  ctx->cpu_profiler->Dispose();
+  ctx->cpu_profiler = nullptr;
+
+  std::string data = builder.Serialize();
+  char* mem = (char*)malloc(data.size());
+  memcpy(mem, data.data(), data.size());
+  rtn.data = mem;
+  rtn.length = data.size();
+  return rtn;
+}
+
+int StartHeapSampling(ContextPtr ptr, uint64_t interval, int stack_depth) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  HeapProfiler* profiler = isolate->GetHeapProfiler();
+  return profiler->StartSamplingHeapProfiler(interval, stack_depth) ? 0 : 1;
+}
+
+void StopHeapSampling(ContextPtr ptr) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  isolate->GetHeapProfiler()->StopSamplingHeapProfiler();
+}
+
+void AddAllocationSamples(Isolate* isolate,
+                          ProfileBuilder& builder,
+                          std::vector<uint64_t>& stack,
+                          const AllocationProfile::Node* node) {
+  String::Utf8Value name(isolate, node->name);
+  String::Utf8Value script_name(isolate, node->script_name);
+  std::string function = name.length() > 0 ? *name : "(anonymous)";
+  std::string filename = script_name.length() > 0 ? *script_name : "";
+
+  stack.push_back(builder.Location(function, filename, node->line_number,
+                                   node->line_number));
+
+  int64_t count = 0;
+  int64_t bytes = 0;
+  for (auto& allocation : node->allocations) {
+    count += allocation.count;
+    bytes += int64_t(allocation.size) * allocation.count;
+  }
+
+  if (count > 0) {
+    // pprof wants the leaf first
+    std::vector<uint64_t> locations(stack.rbegin(), stack.rend());
+    std::vector<int64_t> values = {count, bytes};
+    builder.AddSample(locations, values);
+  }
+
+  for (const AllocationProfile::Node* child : node->children) {
+    AddAllocationSamples(isolate, builder, stack, child);
+  }
+
+  stack.pop_back();
+}
+
+RtnBytes GetAllocationProfile(ContextPtr ptr, uint64_t interval) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  RtnBytes rtn = {nullptr, 0};
+
+  std::unique_ptr<AllocationProfile> profile(
+      isolate->GetHeapProfiler()->GetAllocationProfile());
+  if (!profile) {
+    return rtn;
+  }
+
+  ProfileBuilder builder;
+  builder.AddSampleType("inuse_objects", "count");
+  builder.AddSampleType("inuse_space", "bytes");
+  builder.SetPeriod("space", "bytes", interval);
+  builder.SetTime(WallClockNanos(), 0);
+
+  // The root node is synthetic, so start with its children
+  std::vector<uint64_t> stack;
+  for (const AllocationProfile::Node* child : profile->GetRootNode()->children) {
+    AddAllocationSamples(isolate, builder, stack, child);
+  }
+
+  std::string data = builder.Serialize();
+  char* mem = (char*)malloc(data.size());
+  memcpy(mem, data.data(), data.size());
+  rtn.data = mem;
+  rtn.length = data.size();
+  return rtn;
+}
+
+// Streams serialized heap snapshot chunks to a Go writer
+class SnapshotStream : public OutputStream {
+ public:
+  explicit SnapshotStream(int writer_token) : writer_token_(writer_token) {}
+
+  int GetChunkSize() override { return 64 * 1024; }
+
+  void EndOfStream() override {}
+
+  WriteResult WriteAsciiChunk(char* data, int size) override {
+    if (WriteHeapSnapshotChunk(data, size, writer_token_) != 0) {
+      return kAbort;
+    }
+    return kContinue;
+  }
+
+ private:
+  int writer_token_;
+};
+
+void WriteHeapSnapshot(ContextPtr ptr, int writer_token) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  HeapProfiler* profiler = isolate->GetHeapProfiler();
+  const HeapSnapshot* snapshot = profiler->TakeHeapSnapshot();
+
+  SnapshotStream stream(writer_token);
+  snapshot->Serialize(&stream, HeapSnapshot::kJSON);
+  const_cast<HeapSnapshot*>(snapshot)->Delete();
 }
 
 void DisposeContext(ContextPtr ptr) {
@@ -334,11 +2899,32 @@ void DisposeContext(ContextPtr ptr) {
   }
 
   m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  CallTimer timer(processCalls[kCallDisposeContext]);
   Isolate* isolate = ctx->isolate;
-  Locker locker(isolate);
-  Isolate::Scope isolate_scope(isolate);
-  ctx->ptr.Reset();
+  {
+    Locker locker(isolate);
+    timer.Phase(kPhaseLock);
+    Isolate::Scope isolate_scope(isolate);
+    for (auto& entry : ctx->modules) {
+      entry.second->ptr.Reset();
+      delete entry.second;
+    }
+    ctx->modules.clear();
+    if (ctx->cpu_profiler != nullptr) {
+      ctx->cpu_profiler->Dispose();
+    }
+    for (auto& entry : ctx->timers) {
+      delete entry.second;
+    }
+    ctx->timers.clear();
+    ctx->ptr.Reset();
+    ctx->microtask_queue.reset();
+  }
+
+  // The isolate must not be entered by any thread when it is disposed
   isolate->Dispose();
+  delete ctx->allocator;
+  delete ctx->log;
   delete ctx;
 }
 
@@ -347,9 +2933,11 @@ void DisposeContext(ContextPtr ptr) {
 const char* ValueToString(ValuePtr ptr) {
   m_value* val = static_cast<m_value*>(ptr);
   m_ctx* ctx = val->context;
+  CallTimer timer(ctx->calls[kCallValueToString]);
   Isolate* isolate = ctx->isolate;
 
   Locker locker(isolate);
+  timer.Phase(kPhaseLock);
   Isolate::Scope isolate_scope(isolate);
   HandleScope handle_scope(isolate);
   Context::Scope context_scope(ctx->ptr.Get(isolate));
@@ -357,7 +2945,9 @@ const char* ValueToString(ValuePtr ptr) {
   Local<Value> value = val->ptr.Get(isolate);
   String::Utf8Value utf8(isolate, value);
 
-  return CopyString(utf8);
+  const char* str = CopyString(utf8);
+  timer.Phase(kPhaseMarshal);
+  return str;
 }
 
 void DisposeValue(ValuePtr ptr) {
@@ -389,45 +2979,195 @@ const char* Version() {
 
 // Send
 
-int Send(ContextPtr ptr, size_t length, void* data) {
-  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+// Passes data to the callback registered with V8Engine.cb. The callback's
+// result is only returned when result is set.
+RtnValue SendMessage(m_ctx* ctx, size_t length, void* data, bool result) {
+  TraceSpan span("Send");
+  CallTimer timer(ctx->calls[kCallSend]);
   Isolate* isolate = ctx->isolate;
   Locker locker(isolate);
+  timer.Phase(kPhaseLock);
   Isolate::Scope isolate_scope(isolate);
   HandleScope handle_scope(isolate);
   TryCatch try_catch(isolate);
 
   Local<Context> context = ctx->ptr.Get(isolate);
   Context::Scope context_scope(context);
+  MicrotasksScope microtasks_scope(isolate, ctx->microtask_queue.get(),
+                                   MicrotasksScope::kRunMicrotasks);
+
+  RtnValue rtn = {nullptr, {nullptr, nullptr, nullptr, kErrorException}};
 
   Local<Function> cb = Local<Function>::New(isolate, ctx->cb);
   if (cb.IsEmpty()) {
-    return 2;
+    free(data);
+    rtn.error.msg = CopyString("SendError: no callback registered with cb");
+    return rtn;
   }
 
   Local<Value> args[1];
 
+  // data comes from C.CBytes, so it is released with free() rather than the
+  // isolate's allocator
   auto callback = [](void* data, size_t length, void* deleter_data) {
-    if (deleter_data == nullptr) {
-      return;
-    }
-
-    static_cast<ArrayBuffer::Allocator*>(deleter_data)->Free(data, length);
+    free(data);
   };
-  std::unique_ptr<BackingStore> backing = ArrayBuffer::NewBackingStore(
-      data, length, callback, isolate->GetArrayBufferAllocator());
+  std::unique_ptr<BackingStore> backing =
+      ArrayBuffer::NewBackingStore(data, length, callback, nullptr);
   args[0] = ArrayBuffer::New(isolate, std::move(backing));
   assert(!args[0].IsEmpty());
   assert(!try_catch.HasCaught());
+  timer.Phase(kPhaseMarshal);
 
   auto ret = cb->Call(context, context->Global(), 1, args);
+  timer.Phase(kPhaseExecute);
 
   if (try_catch.HasCaught()) {
-    auto err = ExceptionError(try_catch, isolate, context);
-    printf("%s\n", err.msg);
-    printf("%s\n", err.stack);
-    return 3;
+    rtn.error = ExceptionError(try_catch, isolate, context);
+    return rtn;
   }
 
-  return 0;
+  if (result) {
+    m_value* val = new m_value;
+    val->context = ctx;
+    val->ptr.Reset(isolate, ret.ToLocalChecked());
+    rtn.value = static_cast<ValuePtr>(val);
+  }
+  return rtn;
+}
+
+RtnError Send(ContextPtr ptr, size_t length, void* data) {
+  return SendMessage(static_cast<m_ctx*>(ptr), length, data, false).error;
+}
+
+// Awaiting
+
+// Wait between checks of a pending promise when no timer is due sooner, so
+// that tasks posted by background threads (such as asynchronous WebAssembly
+// compilation) are picked up
+const int64_t kAwaitPollMs = 10;
+
+// Settles rtn once its value is a settled promise: a fulfilled promise is
+// replaced by its value, a rejected one by an error. Values that are not
+// promises are settled as they are. Runs the queued microtasks first.
+bool Settle(m_ctx* ctx, RtnValue* rtn) {
+  Isolate* isolate = ctx->isolate;
+  Locker locker(isolate);
+  Isolate::Scope isolate_scope(isolate);
+  HandleScope handle_scope(isolate);
+
+  Local<Context> context = ctx->ptr.Get(isolate);
+  Context::Scope context_scope(context);
+
+  RunMicrotasks(ctx);
+
+  m_value* val = static_cast<m_value*>(rtn->value);
+  Local<Value> value = val->ptr.Get(isolate);
+  if (!value->IsPromise()) {
+    return true;
+  }
+
+  Local<Promise> promise = value.As<Promise>();
+  switch (promise->State()) {
+    case Promise::kPending:
+      return false;
+    case Promise::kFulfilled:
+      val->ptr.Reset(isolate, promise->Result());
+      return true;
+    case Promise::kRejected: {
+      Local<Value> reason = promise->Result();
+      rtn->error = ValueError(isolate, context, reason,
+                              Exception::CreateMessage(isolate, reason));
+      DisposeValue(val);
+      rtn->value = nullptr;
+      return true;
+    }
+  }
+  return true;
+}
+
+RtnValue AwaitError(RtnValue rtn, const char* msg, int kind) {
+  DisposeValue(rtn.value);
+  rtn.value = nullptr;
+  rtn.error.msg = CopyString(msg);
+  rtn.error.kind = kind;
+  return rtn;
+}
+
+// Runs the event loop until the promise in rtn settles, the deadline (in
+// LoopNow milliseconds) passes or *stop is set
+RtnValue Await(m_ctx* ctx, RtnValue rtn, uint64_t deadline, int* stop) {
+  if (rtn.value == nullptr) {
+    return rtn;
+  }
+
+  while (!Settle(ctx, &rtn)) {
+    RtnError error = Tick(ctx);
+    if (error.msg != nullptr) {
+      DisposeValue(rtn.value);
+      rtn.value = nullptr;
+      rtn.error = error;
+      return rtn;
+    }
+    if (Settle(ctx, &rtn)) {
+      break;
+    }
+
+    int64_t wait = NextTimer(ctx);
+    if (wait < 0 || wait > kAwaitPollMs) {
+      wait = kAwaitPollMs;
+    }
+
+    std::unique_lock<std::mutex> lock(ctx->loop_mutex);
+    if (stop != nullptr && *stop) {
+      return AwaitError(rtn, "Canceled: awaiting the promise was canceled",
+                        kErrorCanceled);
+    }
+    uint64_t now = LoopNow(ctx);
+    if (now >= deadline) {
+      return AwaitError(
+          rtn, "DeadlineExceeded: the promise did not settle in time",
+          kErrorDeadline);
+    }
+    if (static_cast<uint64_t>(wait) > deadline - now) {
+      wait = deadline - now;
+    }
+    ctx->loop_cv.wait_for(lock, std::chrono::milliseconds(wait), [&] {
+      return ctx->loop_wakeup || (stop != nullptr && *stop);
+    });
+    ctx->loop_wakeup = false;
+  }
+  return rtn;
+}
+
+uint64_t AwaitDeadline(m_ctx* ctx, int64_t timeout_ms) {
+  if (timeout_ms < 0) {
+    return UINT64_MAX;
+  }
+  return LoopNow(ctx) + timeout_ms;
+}
+
+RtnValue RunAwait(ContextPtr ptr,
+                  const char* source,
+                  size_t source_length,
+                  const char* origin,
+                  size_t origin_length,
+                  int64_t timeout_ms,
+                  int* stop) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  uint64_t deadline = AwaitDeadline(ctx, timeout_ms);
+  RtnValue rtn =
+      RunSource(ctx, source, source_length, nullptr, origin, origin_length);
+  return Await(ctx, rtn, deadline, stop);
+}
+
+RtnValue SendAwait(ContextPtr ptr,
+                   size_t length,
+                   void* data,
+                   int64_t timeout_ms,
+                   int* stop) {
+  m_ctx* ctx = static_cast<m_ctx*>(ptr);
+  uint64_t deadline = AwaitDeadline(ctx, timeout_ms);
+  RtnValue rtn = SendMessage(ctx, length, data, true);
+  return Await(ctx, rtn, deadline, stop);
 }
@@ -4,16 +4,27 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdlib.h>
 
 typedef void* ContextPtr;
 typedef void* IsolatePtr;
 typedef void* ValuePtr;
+typedef void* StreamPtr;
+
+enum {
+  kErrorException = 0,
+  kErrorTerminated = 1,
+  kErrorHeapLimit = 2,
+  kErrorDeadline = 3,
+  kErrorCanceled = 4,
+};
 
 typedef struct {
   const char* msg;
   const char* location;
   const char* stack;
+  int kind;
 } RtnError;
 
 typedef struct {
@@ -21,17 +32,317 @@ typedef struct {
   RtnError error;
 } RtnValue;
 
+typedef struct {
+  const char* data;
+  size_t length;
+} RtnBytes;
+
+typedef struct {
+  ValuePtr function;
+  RtnBytes cache;  // code cache, when requested
+  int cache_rejected;
+  RtnError error;
+} RtnFunction;
+
+// Kinds of HostValue
+enum {
+  kHostUndefined = 0,
+  kHostNull = 1,
+  kHostBoolean = 2,  // number is 0 or 1
+  kHostNumber = 3,
+  kHostString = 4,  // UTF-8 at offset and length in the strings buffer
+  kHostValue = 5,   // value belongs to the same context
+};
+
+// An argument passed from the host to a function
+typedef struct {
+  int kind;
+  double number;
+  ValuePtr value;
+  size_t offset;
+  size_t length;
+} HostValue;
+
+typedef struct {
+  RtnBytes strings;  // the string values point into this buffer
+  RtnError error;
+} RtnHostValues;
+
+typedef struct {
+  size_t array_buffer_limit;  // 0 means unlimited
+  int huge_pages;
+
+  // Heap generation sizes in bytes, 0 means V8's default
+  size_t initial_old_generation_size;
+  size_t max_old_generation_size;
+  size_t initial_young_generation_size;
+  size_t max_young_generation_size;
+
+  // Write JIT code to /tmp/perf-<pid>.map for Linux perf
+  int perf_map;
+
+  // Buffer print and log output for DrainLog instead of writing it to
+  // stdout and stderr. 0 writes it directly.
+  size_t log_buffer_size;
+  int log_policy;
+
+  int microtask_policy;
+  // Give the context its own microtask queue instead of the isolate's
+  int microtask_queue;
+} EngineConfig;
+
+// When promise jobs and other microtasks run, see v8::MicrotasksPolicy
+enum {
+  kMicrotasksAuto = 0,      // when a call from the host returns
+  kMicrotasksExplicit = 1,  // only in PerformMicrotaskCheckpoint
+  kMicrotasksScoped = 2,    // when the outermost entry point returns
+};
+
+// Streams of print and log output
+enum {
+  kLogStdout = 1,
+  kLogStderr = 2,
+};
+
+// What happens to output that does not fit into the log buffer
+enum {
+  kLogDrop = 0,
+  kLogBlock = 1,
+};
+
+// Durations are in nanoseconds
+typedef struct {
+  uint64_t count;
+  uint64_t total;
+  uint64_t max;
+  uint64_t p50;
+  uint64_t p90;
+  uint64_t p99;
+} HistogramSnapshot;
+
+typedef struct {
+  size_t total_heap_size;
+  size_t total_heap_size_executable;
+  size_t total_physical_size;
+  size_t total_available_size;
+  size_t used_heap_size;
+  size_t heap_size_limit;
+  size_t malloced_memory;
+  size_t peak_malloced_memory;
+  size_t external_memory;
+  size_t number_of_native_contexts;
+  size_t number_of_detached_contexts;
+} HeapStats;
+
+typedef struct {
+  const char* name;
+  size_t space_size;
+  size_t space_used_size;
+  size_t space_available_size;
+  size_t physical_space_size;
+} HeapSpaceStats;
+
+// GC types, in the bit order of v8::GCType
+enum {
+  kGCTypeScavengeIndex = 0,
+  kGCTypeMarkSweepCompactIndex = 1,
+  kGCTypeIncrementalMarkingIndex = 2,
+  kGCTypeProcessWeakCallbacksIndex = 3,
+  kGCTypeCount = 4,
+};
+
+// Instrumented entry points. NewContext and DisposeContext are measured
+// process-wide, the others per engine.
+enum {
+  kCallRun = 0,
+  kCallLoadModule = 1,
+  kCallSend = 2,
+  kCallValueToString = 3,
+  kCallFunction = 4,
+  kCallNewContext = 5,
+  kCallDisposeContext = 6,
+  kCallCount = 7,
+};
+
+// Phases of an entry point call. A phase is only recorded for calls that
+// reach it.
+enum {
+  kPhaseLock = 0,  // waiting for the isolate's Locker
+  kPhaseCompile = 1,
+  kPhaseExecute = 2,
+  kPhaseMarshal = 3,  // converting results and errors for the caller
+  kPhaseTotal = 4,
+  kPhaseCount = 5,
+};
+
+typedef struct {
+  size_t allocated;
+  size_t peak;
+  size_t limit;
+  size_t failed;
+} ArrayBufferStats;
+
+typedef struct {
+  size_t count;
+  size_t bytes;
+  size_t limit;
+  size_t evicted;
+} ModuleStats;
+
+typedef struct {
+  size_t modules;
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t disk_hits;  // misses served from the cache directory
+} WasmCacheStats;
+
 // Initialize V8
 extern void InitV8();
 
+// Tracing is process-wide. Categories are comma-separated. Returns nonzero if
+// tracing is already enabled.
+extern int EnableTracing(const char* categories, size_t length);
+extern void DisableTracing();
+
 // Contexts
-extern ContextPtr NewContext();
-extern RtnValue Run(ContextPtr context, const char* source, const char* origin);
-extern int LoadModule(ContextPtr ptr,
-                      char* source_s,
-                      char* name_s,
-                      int callback_index);
+extern ContextPtr NewContext(EngineConfig config);
+// Strings passed with an explicit length are not NUL-terminated and only have
+// to stay valid for the duration of the call
+extern RtnValue Run(ContextPtr context,
+                    const char* source,
+                    size_t source_length,
+                    const char* origin,
+                    size_t origin_length);
+extern RtnValue RunFile(ContextPtr context,
+                        const char* path,
+                        const char* origin);
+extern StreamPtr StartStream(ContextPtr context,
+                             const char* origin,
+                             size_t origin_length);
+extern void StreamPush(StreamPtr stream, const char* data, size_t length);
+extern RtnValue FinishStream(StreamPtr stream);
+extern void AbortStream(StreamPtr stream);
+
+// Functions. The param_count parameter names are stored back to back in
+// params, with their lengths in param_lengths. A cache produced by an earlier
+// compile of the same function is consumed when given; with produce_cache
+// set, the function's code cache is returned.
+extern RtnFunction CompileFunction(ContextPtr context,
+                                   const char* params,
+                                   const size_t* param_lengths,
+                                   size_t param_count,
+                                   const char* body,
+                                   size_t body_length,
+                                   const char* origin,
+                                   size_t origin_length,
+                                   const char* cache,
+                                   size_t cache_length,
+                                   int produce_cache);
+// Calls a function value with the global object as receiver. The string
+// arguments of args all point into strings; those out of its bounds fail the
+// call with a RangeError.
+extern RtnValue CallFunction(ValuePtr function,
+                             const HostValue* args,
+                             size_t argc,
+                             const char* strings,
+                             size_t strings_length);
+
+// Objects. Property names are interned once with InternKey and passed by the
+// returned handle afterwards. GetMany fills in count values; string values
+// point into the returned buffer. The string values passed to SetMany and
+// SetGlobals point into strings, and fail the call with a RangeError when out
+// of its bounds.
+extern int InternKey(ContextPtr context, const char* key, size_t length);
+extern ValuePtr NewObject(ContextPtr context);
+extern RtnHostValues GetMany(ValuePtr object,
+                             const int* keys,
+                             size_t count,
+                             HostValue* values);
+extern RtnError SetMany(ValuePtr object,
+                        const int* keys,
+                        size_t count,
+                        const HostValue* values,
+                        const char* strings,
+                        size_t strings_length);
+extern RtnError SetGlobals(ContextPtr context,
+                           const int* keys,
+                           size_t count,
+                           const HostValue* values,
+                           const char* strings,
+                           size_t strings_length);
+
+// WebAssembly. CompileWasm returns a WebAssembly.Module, compiled at most once
+// per process for the same wire bytes. With a cache directory set, compiled
+// modules are also serialized there and reused by later processes.
+extern RtnValue CompileWasm(ContextPtr context,
+                            const char* data,
+                            size_t length);
+extern RtnBytes SerializeWasm(ValuePtr module);
+extern RtnValue DeserializeWasm(ContextPtr context,
+                                const char* serialized,
+                                size_t serialized_length,
+                                const char* data,
+                                size_t length);
+extern void SetWasmCacheDir(const char* dir);
+extern void ClearWasmCache();
+extern WasmCacheStats GetWasmCacheStats();
+
+extern RtnError LoadModule(ContextPtr ptr,
+                           const char* source_s,
+                           size_t source_length,
+                           const char* name_s,
+                           size_t name_length,
+                           int callback_index);
+extern RtnError LoadModuleBundle(ContextPtr ptr,
+                                 const char* data,
+                                 size_t length);
+extern RtnError LoadModuleBundleFile(ContextPtr ptr, const char* path);
+extern RtnBytes CompileModuleCodeCache(ContextPtr ptr,
+                                       const char* source_s,
+                                       size_t source_length,
+                                       const char* name_s,
+                                       size_t name_length);
+extern int UnloadModule(ContextPtr ptr, const char* name);
+extern void SetModuleCacheLimit(ContextPtr ptr, size_t bytes);
+extern ModuleStats GetModuleStats(ContextPtr ptr);
 extern void DisposeContext(ContextPtr context);
+extern void PerformMicrotaskCheckpoint(ContextPtr context);
+
+// Event loop. Tick runs pending platform tasks and the timers that are due
+// without waiting; NextTimer returns the milliseconds until the next timer is
+// due, or -1 when none is pending.
+extern RtnError Tick(ContextPtr context);
+extern int64_t NextTimer(ContextPtr context);
+extern RtnError RunLoop(ContextPtr context, int* stop);
+extern void StopLoop(ContextPtr context, int* stop);
+
+// Moves buffered output into buf as records of a 4-byte little-endian length,
+// a stream byte and the line. Returns the number of bytes written.
+extern size_t DrainLog(ContextPtr context, char* buf, size_t length);
+extern uint64_t GetLogDropped(ContextPtr context);
+extern ArrayBufferStats GetArrayBufferStats(ContextPtr context);
+
+// Heap
+extern void MemoryPressure(ContextPtr context, int level);
+extern void SetIdle(ContextPtr context, int idle);
+extern int IdleNotification(ContextPtr context, double idle_time_in_seconds);
+extern HeapStats GetHeapStats(ContextPtr context);
+extern size_t GetHeapSpaceStats(ContextPtr context,
+                                HeapSpaceStats* spaces,
+                                size_t n);
+extern HistogramSnapshot GetGCStats(ContextPtr context, int gc_type);
+extern HistogramSnapshot GetCallStats(ContextPtr context, int call, int phase);
+extern HistogramSnapshot GetProcessCallStats(int call, int phase);
+
+// Profiling, profiles are returned in the pprof protobuf format
+extern int StartCPUProfile(ContextPtr context, int interval_us);
+extern RtnBytes StopCPUProfile(ContextPtr context);
+extern int StartHeapSampling(ContextPtr context,
+                             uint64_t interval,
+                             int stack_depth);
+extern void StopHeapSampling(ContextPtr context);
+extern RtnBytes GetAllocationProfile(ContextPtr context, uint64_t interval);
+extern void WriteHeapSnapshot(ContextPtr context, int writer_token);
 
 // Values
 const char* ValueToString(ValuePtr ptr);
@@ -41,7 +352,24 @@ extern void DisposeValue(ValuePtr value);
 const char* Version();
 
 // Send
-int Send(ContextPtr context, size_t length, void* data);
+RtnError Send(ContextPtr context, size_t length, void* data);
+
+// Awaiting. Like Run and Send, but when the result is a promise the event
+// loop runs until it settles and its value or rejection is returned. Waiting
+// ends with kErrorDeadline after timeout_ms (unless negative), or with
+// kErrorCanceled once StopLoop is called with stop, which may be NULL.
+extern RtnValue RunAwait(ContextPtr context,
+                         const char* source,
+                         size_t source_length,
+                         const char* origin,
+                         size_t origin_length,
+                         int64_t timeout_ms,
+                         int* stop);
+extern RtnValue SendAwait(ContextPtr context,
+                          size_t length,
+                          void* data,
+                          int64_t timeout_ms,
+                          int* stop);
 
 #ifdef __cplusplus
 }
@@ -0,0 +1,90 @@
+package v8engine
+
+// #include <stdlib.h>
+// #include "v8engine.h"
+import "C"
+
+import (
+	"unsafe"
+)
+
+// WasmModule is a compiled WebAssembly.Module. It can be passed to scripts,
+// for example with SetGlobals or Function.Call, and instantiated there with
+// WebAssembly.instantiate.
+type WasmModule struct {
+	*Value
+}
+
+// CompileWasm compiles a WebAssembly module. The compiled code is cached for
+// the whole process by the hash of bytes, so compiling the same module in
+// other engines only creates a new module object for it. See also
+// SetWasmCacheDir. Compile errors are returned as a *JSError.
+func (e *Engine) CompileWasm(bytes []byte) (*WasmModule, error) {
+	if len(bytes) == 0 {
+		return nil, &JSError{Message: "CompileError: empty WebAssembly module"}
+	}
+
+	rtn := C.CompileWasm(e.contextPtr, (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes)))
+	if err := getError(rtn); err != nil {
+		return nil, err
+	}
+	return &WasmModule{e.getValue(rtn)}, nil
+}
+
+// Serialize returns the compiled code of the module, which DeserializeWasm
+// turns back into a module without compiling it. It returns nil if the module
+// cannot be serialized yet.
+func (m *WasmModule) Serialize() []byte {
+	return getBytes(C.SerializeWasm(m.ptr))
+}
+
+// DeserializeWasm recreates a module from the output of Serialize and the
+// module's wire bytes. When serialized was produced by another V8 version or
+// with other flags, the module is compiled from bytes instead.
+func (e *Engine) DeserializeWasm(serialized, bytes []byte) (*WasmModule, error) {
+	if len(bytes) == 0 {
+		return nil, &JSError{Message: "CompileError: empty WebAssembly module"}
+	}
+
+	rtn := C.DeserializeWasm(e.contextPtr, bytesPtr(serialized), C.size_t(len(serialized)), (*C.char)(unsafe.Pointer(&bytes[0])), C.size_t(len(bytes)))
+	if err := getError(rtn); err != nil {
+		return nil, err
+	}
+	return &WasmModule{e.getValue(rtn)}, nil
+}
+
+// SetWasmCacheDir makes CompileWasm keep serialized modules in dir, so they
+// survive restarts of the process. Files written by another V8 version, or
+// damaged, are replaced. An empty dir disables the disk cache.
+func SetWasmCacheDir(dir string) {
+	cDir := C.CString(dir)
+	defer C.free(unsafe.Pointer(cDir))
+
+	C.SetWasmCacheDir(cDir)
+}
+
+// ClearWasmCache releases the compiled modules cached in memory. Existing
+// module objects keep their code.
+func ClearWasmCache() {
+	C.ClearWasmCache()
+}
+
+// WasmCacheStats describes the process-wide cache of compiled Wasm modules.
+// DiskHits counts the misses served from the cache directory.
+type WasmCacheStats struct {
+	Modules  int
+	Hits     int
+	Misses   int
+	DiskHits int
+}
+
+// GetWasmCacheStats returns the size and hit counts of the Wasm module cache
+func GetWasmCacheStats() WasmCacheStats {
+	stats := C.GetWasmCacheStats()
+	return WasmCacheStats{
+		Modules:  int(stats.modules),
+		Hits:     int(stats.hits),
+		Misses:   int(stats.misses),
+		DiskHits: int(stats.disk_hits),
+	}
+}